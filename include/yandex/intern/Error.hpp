@@ -3,6 +3,8 @@
 #include "bunsan/error.hpp"
 #include "bunsan/filesystem/error.hpp"
 
+#include <cstddef>
+
 namespace yandex{namespace intern
 {
     struct Error: virtual bunsan::error
@@ -16,4 +18,16 @@ namespace yandex{namespace intern
 
     struct InvalidBinaryFileFormatError: virtual FormatError {};
     struct InvalidFileSizeError: virtual InvalidBinaryFileFormatError {};
+
+    struct MemoryLimitError: virtual Error
+    {
+        typedef boost::error_info<struct tag_memoryLimit, std::size_t> memoryLimit;
+    };
+
+    struct InvalidMemoryLimitError: virtual MemoryLimitError {};
+
+    struct MemoryLimitExceededError: virtual MemoryLimitError
+    {
+        typedef boost::error_info<struct tag_memoryRequired, std::size_t> memoryRequired;
+    };
 }}
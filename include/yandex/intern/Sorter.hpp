@@ -3,16 +3,60 @@
 #include <boost/noncopyable.hpp>
 #include <boost/filesystem/path.hpp>
 
+#include <iosfwd>
+
+#include <cstddef>
+
 namespace yandex{namespace intern
 {
     class Sorter: private boost::noncopyable
     {
     public:
-        /// Default sort implementation.
-        static void sort(const boost::filesystem::path &src, const boost::filesystem::path &dst);
+        /// Memory limit used if nothing is specified.
+        static constexpr std::size_t defaultMemoryLimitBytes = 256 * 1024 * 1024;
+
+        /// Implementations are not guaranteed to work with smaller limit.
+        static constexpr std::size_t minMemoryLimitBytes = 4 * 1024 * 1024;
+
+        enum class Algorithm
+        {
+            automatic,
+            inMemory,
+            balancedSplit,
+            splitMerge,
+            mappedRadix
+        };
+
+    public:
+        /*!
+         * \brief Default sort implementation.
+         *
+         * If algorithm is Algorithm::automatic it is chosen by plan().
+         *
+         * \note Algorithm::inMemory does not fail if radix scratch
+         * can not be allocated, data is sorted in place instead.
+         */
+        static void sort(const boost::filesystem::path &src, const boost::filesystem::path &dst,
+                         const std::size_t memoryLimitBytes=defaultMemoryLimitBytes,
+                         const Algorithm algorithm=Algorithm::automatic);
+
+        /*!
+         * \brief Choose algorithm using input size, memory limit
+         * and space available for temporary files.
+         *
+         * Balanced split is preferred to split merge if applicable,
+         * it never requires more space. Mapped radix is chosen
+         * if only it fits into available space.
+         *
+         * \return anything except Algorithm::automatic
+         */
+        static Algorithm plan(const boost::filesystem::path &src, const boost::filesystem::path &dst,
+                              const std::size_t memoryLimitBytes=defaultMemoryLimitBytes);
 
     public:
-        Sorter(const boost::filesystem::path &src, const boost::filesystem::path &dst);
+        /// \throws InvalidMemoryLimitError if memoryLimitBytes < minMemoryLimitBytes
+        Sorter(const boost::filesystem::path &src, const boost::filesystem::path &dst,
+               const std::size_t memoryLimitBytes=defaultMemoryLimitBytes);
 
         virtual ~Sorter();
 
@@ -22,18 +66,34 @@ namespace yandex{namespace intern
         const boost::filesystem::path &source() const;
         const boost::filesystem::path &destination() const;
 
+        /// Implementation should not allocate more memory than specified.
+        std::size_t memoryLimitBytes() const;
+
     private:
         template <typename Sorter>
-        friend void sort(const boost::filesystem::path &src, const boost::filesystem::path &dst);
+        friend void sort(const boost::filesystem::path &src, const boost::filesystem::path &dst,
+                         const std::size_t memoryLimitBytes);
 
     private:
         const boost::filesystem::path source_, destination_;
+        const std::size_t memoryLimitBytes_;
     };
 
+    /// Names are the same as used by corresponding binaries: auto, in_memory, balanced_split, split_merge, mapped_radix.
+    std::ostream &operator<<(std::ostream &out, const Sorter::Algorithm algorithm);
+    std::istream &operator>>(std::istream &in, Sorter::Algorithm &algorithm);
+
     template <typename SorterImplementation>
-    void sort(const boost::filesystem::path &src, const boost::filesystem::path &dst)
+    void sort(const boost::filesystem::path &src, const boost::filesystem::path &dst,
+              const std::size_t memoryLimitBytes)
     {
-        SorterImplementation sorter(src, dst);
+        SorterImplementation sorter(src, dst, memoryLimitBytes);
         static_cast<Sorter &>(sorter).sort();
     }
+
+    template <typename SorterImplementation>
+    void sort(const boost::filesystem::path &src, const boost::filesystem::path &dst)
+    {
+        sort<SorterImplementation>(src, dst, Sorter::defaultMemoryLimitBytes);
+    }
 }}
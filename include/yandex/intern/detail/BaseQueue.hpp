@@ -18,7 +18,7 @@ namespace yandex{namespace intern{namespace detail
                 std::rethrow_exception(error_);
         }
 
-        inline bool closed__()
+        inline bool closed__() const
         {
             return closed_;
         }
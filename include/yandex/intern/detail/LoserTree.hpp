@@ -0,0 +1,72 @@
+#pragma once
+
+#include "yandex/intern/types.hpp"
+
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace yandex{namespace intern{namespace detail
+{
+    /*!
+     * \brief Tournament tree of losers for k-way merge.
+     *
+     * Every internal node holds the loser of its match,
+     * so replacing the winner replays only its leaf-to-root path:
+     * ceil(log2(k)) comparisons without index indirection.
+     */
+    class LoserTree
+    {
+    public:
+        /// Data extended by exhausted marker greater than any Data.
+        typedef std::uint64_t Key;
+
+        static constexpr Key exhausted = std::numeric_limits<Key>::max();
+
+    public:
+        /// \param keys current keys of inputs, at least one
+        explicit LoserTree(const std::vector<Key> &keys);
+
+        /// Input with the least key.
+        inline std::size_t winner() const
+        {
+            return winner_.input;
+        }
+
+        inline Key winnerKey() const
+        {
+            return winner_.key;
+        }
+
+        /// All inputs are exhausted.
+        inline bool empty() const
+        {
+            return winner_.key == exhausted;
+        }
+
+        /// Set key of winner() and find new winner.
+        inline void replace(const Key key)
+        {
+            Node candidate = {key, winner_.input};
+            for (std::size_t node = (candidate.input + nodes_.size()) / 2; node; node /= 2)
+            {
+                if (nodes_[node].key < candidate.key)
+                    std::swap(nodes_[node], candidate);
+            }
+            winner_ = candidate;
+        }
+
+    private:
+        struct Node
+        {
+            Key key;
+            std::size_t input;
+        };
+
+    private:
+        /// Leaves are implicit at [k, 2k), losers are at [1, k).
+        std::vector<Node> nodes_;
+        Node winner_;
+    };
+}}}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <cstddef>
+
+namespace yandex{namespace intern{namespace detail
+{
+    /*!
+     * \brief Memory shared by threads.
+     *
+     * acquire() blocks until requested memory is released by other threads.
+     */
+    class MemoryBudget: private boost::noncopyable
+    {
+    public:
+        class Guard: private boost::noncopyable
+        {
+        public:
+            Guard(MemoryBudget &budget, const std::size_t size);
+            ~Guard();
+
+        private:
+            MemoryBudget &budget_;
+            const std::size_t size_;
+        };
+
+    public:
+        explicit MemoryBudget(const std::size_t limit);
+
+        /// Request bigger than limit is satisfied when nothing else is acquired.
+        void acquire(const std::size_t size);
+
+        /// As acquire() but does not block, \return false if memory is not available.
+        bool tryAcquire(const std::size_t size);
+
+        void release(const std::size_t size);
+
+        std::size_t acquired() const;
+
+    private:
+        const std::size_t limit_;
+        std::size_t acquired_ = 0;
+        mutable boost::mutex lock_;
+        boost::condition_variable released_;
+    };
+}}}
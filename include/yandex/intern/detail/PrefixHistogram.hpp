@@ -0,0 +1,97 @@
+#pragma once
+
+#include "yandex/intern/types.hpp"
+
+#include <limits>
+#include <vector>
+
+#include <cstdint>
+
+namespace yandex{namespace intern{namespace detail
+{
+    /*!
+     * \brief Two-level histogram of Data prefixes.
+     *
+     * Coarse prefixes are counted for every element.
+     * Coarse prefix which count reaches refineThreshold
+     * is refined to fine prefixes from that moment,
+     * elements counted before are distributed proportionally by finalize().
+     *
+     * Memory usage is proportional to the number of refined prefixes.
+     */
+    class PrefixHistogram
+    {
+    public:
+        static constexpr std::size_t dataBitSize = 8 * sizeof(Data);
+        static constexpr std::size_t coarseBitSize = 16;
+        static constexpr std::size_t fineBitSize = 24;
+        static constexpr std::size_t refineBitSize = fineBitSize - coarseBitSize;
+
+        static constexpr std::size_t coarseSize = std::size_t(1) << coarseBitSize;
+        static constexpr std::size_t refineSize = std::size_t(1) << refineBitSize;
+        static constexpr std::size_t refineMask = refineSize - 1;
+
+    public:
+        /// \param maxRefined refinement stops when this number is reached
+        PrefixHistogram(const std::uint64_t refineThreshold, const std::size_t maxRefined);
+
+        inline void add(const Data *const data, const std::size_t size)
+        {
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                const std::size_t coarse = data[i] >> (dataBitSize - coarseBitSize);
+                const std::uint64_t count = ++coarse_[coarse];
+                const std::uint32_t refined = coarse2refined_[coarse];
+                if (refined != notRefined)
+                    ++fine_[refined * refineSize + ((data[i] >> (dataBitSize - fineBitSize)) & refineMask)];
+                else if (count == refineThreshold_ && refinedNumber() < maxRefined_)
+                    refine(coarse, data[i]);
+            }
+        }
+
+        /*!
+         * \brief Add counters of histogram built from another part of input.
+         *
+         * Prefix refined by any of histograms is refined in result,
+         * so number of refined prefixes may exceed maxRefined.
+         *
+         * \warning Both histograms should not be finalized.
+         */
+        void merge(const PrefixHistogram &histogram);
+
+        /*!
+         * \brief Estimate fine counters and scale all counters.
+         *
+         * \warning add() behavior is undefined after finalize()
+         */
+        void finalize(const double scale=1);
+
+        std::uint64_t coarse(const std::size_t coarsePrefix) const;
+
+        bool isRefined(const std::size_t coarsePrefix) const;
+
+        /// \warning If !isRefined(coarsePrefix) behavior is undefined.
+        std::uint64_t fine(const std::size_t coarsePrefix, const std::size_t refinePrefix) const;
+
+        std::size_t refinedNumber() const;
+
+        /// Memory used by histogram without refined prefixes.
+        static constexpr std::size_t coarseByteSize =
+            coarseSize * (sizeof(std::uint64_t) + sizeof(std::uint32_t));
+
+        /// Memory used by single refined prefix.
+        static constexpr std::size_t refinedByteSize = refineSize * sizeof(std::uint64_t);
+
+    private:
+        void refine(const std::size_t coarse, const Data data);
+
+    private:
+        static constexpr std::uint32_t notRefined = std::numeric_limits<std::uint32_t>::max();
+
+        const std::uint64_t refineThreshold_;
+        const std::size_t maxRefined_;
+        std::vector<std::uint64_t> coarse_;
+        std::vector<std::uint32_t> coarse2refined_;
+        std::vector<std::uint64_t> fine_;
+    };
+}}}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "yandex/intern/types.hpp"
+
+#include <limits>
+#include <vector>
+
+#include <cstdint>
+
+namespace yandex{namespace intern{namespace detail
+{
+    /*!
+     * \brief Maps Data to id of prefix tree node it belongs to.
+     *
+     * Prefix tree node is stored with leading 1 bit,
+     * so node of depth d is (1 << d) | (d higher bits of Data).
+     *
+     * Nodes up to coarse depth are routed by single table lookup,
+     * deeper nodes use additional table per coarse prefix.
+     */
+    class PrefixRouter
+    {
+    public:
+        static constexpr std::size_t dataBitSize = 8 * sizeof(Data);
+        static constexpr std::size_t coarseBitSize = 16;
+        static constexpr std::size_t fineBitSize = 24;
+        static constexpr std::size_t refineBitSize = fineBitSize - coarseBitSize;
+
+        static constexpr std::size_t coarseSize = std::size_t(1) << coarseBitSize;
+        static constexpr std::size_t refineSize = std::size_t(1) << refineBitSize;
+        static constexpr std::size_t refineMask = refineSize - 1;
+
+        static constexpr std::size_t maxId = (std::uint32_t(1) << 31) - 1;
+
+    public:
+        PrefixRouter()=default;
+
+        /*!
+         * \param id2prefix nodes of depth at most fineBitSize,
+         * every Data should belong to exactly one node
+         */
+        explicit PrefixRouter(const std::vector<Data> &id2prefix);
+
+        inline std::size_t operator()(const Data data) const
+        {
+            const std::uint32_t id = coarse2id_[data >> (dataBitSize - coarseBitSize)];
+            if (id & refinedFlag)
+                return fine2id_[((id & ~refinedFlag) << refineBitSize) |
+                                ((data >> (dataBitSize - fineBitSize)) & refineMask)];
+            return id;
+        }
+
+        /*!
+         * \brief Route size elements to ids.
+         *
+         * Coarse lookup is vectorized with AVX2 if CPU supports it.
+         */
+        void operator()(const Data *const data, const std::size_t size, std::uint32_t *const ids) const;
+
+        /// Number of coarse prefixes routed by additional table.
+        std::size_t refinedNumber() const;
+
+    private:
+        static constexpr std::uint32_t refinedFlag = std::uint32_t(1) << 31;
+        static constexpr std::uint32_t notRouted = std::numeric_limits<std::uint32_t>::max();
+
+        std::vector<std::uint32_t> coarse2id_;
+        std::vector<std::uint32_t> fine2id_;
+    };
+}}}
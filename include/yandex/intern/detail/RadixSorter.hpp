@@ -0,0 +1,56 @@
+#pragma once
+
+#include "yandex/intern/types.hpp"
+#include "yandex/intern/detail/MemoryMap.hpp"
+#include "yandex/intern/detail/radixSort.hpp"
+
+#include <boost/noncopyable.hpp>
+
+#include <vector>
+
+namespace yandex{namespace intern{namespace detail
+{
+    /*!
+     * \brief Radix sort with scratch memory reused between calls.
+     *
+     * Scratch is anonymous page-aligned mapping which only grows,
+     * so sorting many blocks of similar size
+     * does not allocate, zero or fault memory again.
+     * Object is not thread safe, use one per thread.
+     */
+    class RadixSorter: private boost::noncopyable
+    {
+    public:
+        /// Scratch of at least this size is advised to use transparent huge pages.
+        static constexpr std::size_t hugePageSize = 2 * 1024 * 1024;
+
+    public:
+        explicit RadixSorter(const bool hugePages=true);
+
+        /// Make scratch hold at least size elements, \return false on out of memory
+        bool reserve(const std::size_t size) noexcept;
+
+        /// Number of elements scratch holds.
+        std::size_t capacity() const noexcept;
+
+        /// Unmap scratch.
+        void release() noexcept;
+
+        /// As radix::parallelSort(), \return false on out of memory
+        bool sort(Data *const data,
+                  const std::size_t size,
+                  const std::size_t beginBlock=0,
+                  const std::size_t endBlock=radix::iterations,
+                  const std::size_t threads=1) noexcept;
+
+        /// \copydoc RadixSorter::sort()
+        bool sort(std::vector<Data> &data,
+                  const std::size_t beginBlock=0,
+                  const std::size_t endBlock=radix::iterations,
+                  const std::size_t threads=1) noexcept;
+
+    private:
+        const bool hugePages_;
+        MemoryMap scratch_;
+    };
+}}}
@@ -52,6 +52,11 @@ namespace yandex{namespace intern{namespace detail
             return inputBuffer_.size();
         }
 
+        inline void seek(const std::size_t offset)
+        {
+            inputBuffer_.seek(offset);
+        }
+
         /// \warning may try to read data to check EOF state
         inline bool eof()
         {
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "yandex/intern/types.hpp"
+
+#include <iosfwd>
+#include <vector>
+
+namespace yandex{namespace intern{namespace detail
+{
+    /*!
+     * \brief Detects sorted runs of Data added sequentially.
+     *
+     * Cheap enough to be fused into read pass:
+     * ascents and descents are counted without branches,
+     * positions are stored only while there are few runs.
+     */
+    class RunDetector
+    {
+    public:
+        static constexpr std::size_t defaultMaxRuns = 16;
+
+    public:
+        /// Ends of at most maxRuns runs are stored.
+        explicit RunDetector(const std::size_t maxRuns=defaultMaxRuns);
+
+        void add(const Data *const data, const std::size_t size);
+
+        /// Number of elements added.
+        std::size_t size() const;
+
+        /// Non-decreasing, empty input is sorted.
+        bool isSorted() const;
+
+        /// Non-increasing.
+        bool isReversed() const;
+
+        /// Number of maximal non-decreasing runs.
+        std::size_t runs() const;
+
+        std::size_t maxRuns() const;
+
+        /// \return ends of runs if runs() <= maxRuns(), empty otherwise
+        std::vector<std::size_t> runEnds() const;
+
+    private:
+        const std::size_t maxRuns_;
+        std::size_t size_ = 0;
+        std::size_t ascents_ = 0;
+        std::size_t descents_ = 0;
+        Data last_ = 0;
+        std::vector<std::size_t> runStarts_; ///< except the first one
+    };
+
+    /// "sorted", "reverse sorted", "N sorted runs" or "unsorted, N runs".
+    std::ostream &operator<<(std::ostream &out, const RunDetector &runs);
+}}}
@@ -25,6 +25,7 @@ namespace yandex{namespace intern{namespace detail
         std::size_t bufferSize() const;
         void setBufferSize(const std::size_t bufferSize);
 
+        /// Reads greater than bufferSize() are not buffered if buffer is empty.
         std::size_t read(char *const dst, const std::size_t size);
 
         /// Read all available data without fill().
@@ -32,6 +33,9 @@ namespace yandex{namespace intern{namespace detail
 
         std::size_t size() const;
 
+        /// Drop buffered data and continue reading at offset from file beginning.
+        void seek(const std::size_t offset);
+
         /// \warning calls fill() if dataAvailable() == 0
         bool eof();
 
@@ -44,6 +48,10 @@ namespace yandex{namespace intern{namespace detail
 
         std::size_t dataAvailable() const;
 
+    private:
+        /// Read from descriptor until size or EOF, descriptor is closed on EOF.
+        std::size_t readDirect(char *const dst, const std::size_t size);
+
     private:
         contest::system::unistd::Descriptor inFd_;
         std::vector<char> buffer_;
@@ -37,6 +37,10 @@ namespace yandex{namespace intern{namespace detail
 
         void truncate(const std::size_t size);
 
+        /// Flush and continue writing at offset from file beginning.
+        void seek(const std::size_t offset);
+
+        /// Writes greater than bufferSize() are not buffered if buffer is empty.
         void write(const char *const src, const std::size_t size);
 
         /// Write data to available space without flush().
@@ -51,6 +55,10 @@ namespace yandex{namespace intern{namespace detail
 
         std::size_t spaceAvailable() const;
 
+    private:
+        /// Write all data to descriptor.
+        void writeDirect(const char *const src, const std::size_t size);
+
     private:
         contest::system::unistd::Descriptor outFd_;
         std::vector<char> buffer_;
@@ -37,6 +37,11 @@ namespace yandex{namespace intern{namespace detail
             outputBuffer_.truncate(size);
         }
 
+        inline void seek(const std::size_t offset)
+        {
+            outputBuffer_.seek(offset);
+        }
+
         inline void write(const char *src, const std::size_t size)
         {
             outputBuffer_.write(src, size);
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "yandex/intern/types.hpp"
+
+#include <vector>
+
+namespace yandex{namespace intern{namespace detail
+{
+    /// Sorted run in memory.
+    struct SortedRun
+    {
+        const Data *data;
+        std::size_t size;
+    };
+
+    /*!
+     * \brief Split sorted runs at rank of their merge.
+     *
+     * Splitter value is found by binary search over Data,
+     * elements equal to it are taken from the first runs.
+     *
+     * \return offsets in runs, their sum is rank
+     * and elements before offsets are not greater than elements after offsets
+     */
+    std::vector<std::size_t> coRank(const std::vector<SortedRun> &runs, const std::size_t rank);
+}}}
@@ -1,9 +1,13 @@
 #pragma once
 
 #include "yandex/intern/types.hpp"
+#include "yandex/intern/detail/RunDetector.hpp"
+#include "yandex/intern/detail/simdSort.hpp"
 
 #include <boost/filesystem/path.hpp>
 
+#include <vector>
+
 namespace yandex{namespace intern{namespace detail{namespace radix
 {
     constexpr std::size_t blockBitSize = 8;
@@ -15,6 +19,33 @@ namespace yandex{namespace intern{namespace detail{namespace radix
     constexpr std::size_t bucketsSize = static_cast<std::size_t>(1) << blockBitSize;
     constexpr Data mask = static_cast<Data>(fullBlock);
 
+    /// Sizes not greater than this are sorted by simdSortSmall().
+    constexpr std::size_t maxComparisonSortSize = 4096;
+    static_assert(maxComparisonSortSize <= maxSimdSortSmallSize, "");
+
+    /// Sizes not less than this are sorted by wideDigitBitSize digits.
+    constexpr std::size_t minWideDigitSize = 3 * 512 * 1024;
+    constexpr std::size_t wideDigitBitSize = 11;
+
+    /// Sizes not less than this are scattered by write-combining if Scatter::automatic.
+    constexpr std::size_t minWriteCombiningSize = 1024 * 1024;
+
+    enum class Scatter
+    {
+        automatic,
+        /// Store every element to its bucket.
+        direct,
+        /*!
+         * \brief Stage elements in cache line per bucket,
+         * store full lines by non-temporal stores.
+         *
+         * Requires AVX and at most 11-bit digits,
+         * otherwise Scatter::direct is used.
+         */
+        writeCombining
+    };
+
+    /// Single pass by block, new code should prefer sort().
     void sortIteration(const Data *__restrict__ const src,
                        Data *__restrict__ const dst,
                        const std::size_t size,
@@ -25,14 +56,61 @@ namespace yandex{namespace intern{namespace detail{namespace radix
                     Data *__restrict__ const dst,
                     const std::size_t size) noexcept __attribute__((nonnull));
 
+    /*!
+     * \brief LSD radix sort by digits of DigitBitSize bits.
+     *
+     * Instantiated for 8, 11 and 16 bits,
+     * all Scatter modes are instantiated for 8 and 11 bits.
+     *
+     * \return false on out of memory
+     */
+    template <std::size_t DigitBitSize, Scatter ScatterMode=Scatter::automatic>
+    bool sortMemoryDigits(const Data *__restrict__ const src,
+                          Data *__restrict__ const dst,
+                          const std::size_t size) noexcept __attribute__((nonnull));
+
+    /*!
+     * \brief Choose algorithm by size.
+     *
+     * simdSort() up to maxComparisonSortSize,
+     * 8-bit digits up to minWideDigitSize,
+     * wideDigitBitSize digits otherwise.
+     *
+     * \return false on out of memory
+     */
+    bool sortMemoryAdaptive(const Data *__restrict__ const src,
+                            Data *__restrict__ const dst,
+                            const std::size_t size) noexcept __attribute__((nonnull));
+
+    /// Algorithm is chosen as by sortMemoryAdaptive().
     void sort(std::vector<Data> &data,
               std::vector<Data> &buffer) noexcept;
 
+    /*!
+     * \brief Sort by blocks [beginBlock, endBlock).
+     *
+     * Histograms of all blocks are computed by single pass,
+     * blocks equal for all elements are skipped.
+     *
+     * Full range is sorted as by sort(data, buffer).
+     */
     void sort(std::vector<Data> &data,
               std::vector<Data> &buffer,
               const std::size_t beginBlock,
               const std::size_t endBlock) noexcept;
 
+    /*!
+     * \brief Sort size elements using buffer of the same size.
+     *
+     * Algorithm is chosen as by sort(data, buffer, beginBlock, endBlock),
+     * result is copied to data if the last pass writes to buffer.
+     */
+    void sort(Data *const data,
+              Data *const buffer,
+              const std::size_t size,
+              const std::size_t beginBlock=0,
+              const std::size_t endBlock=iterations) noexcept;
+
     /// \return false on out of memory
     bool sort(std::vector<Data> &data) noexcept;
 
@@ -41,9 +119,96 @@ namespace yandex{namespace intern{namespace detail{namespace radix
               const std::size_t beginBlock,
               const std::size_t endBlock) noexcept;
 
-    /// \note source and destination may be one file
-    void sortFile(const boost::filesystem::path &source,
-                  const boost::filesystem::path &destination,
-                  const std::size_t beginBlock=0,
-                  const std::size_t endBlock=iterations);
+    /// Threads are not used for less than this number of elements per thread.
+    constexpr std::size_t minParallelPartSize = 256 * 1024;
+
+    /// Number of hardware threads, at least 1.
+    std::size_t parallelThreads() noexcept;
+
+    /*!
+     * \brief Sort by blocks [beginBlock, endBlock) using at most threads threads.
+     *
+     * Elements are distributed by the highest block in parallel,
+     * then buckets are sorted independently by thread pool.
+     * Falls back to sort() for small data.
+     */
+    void parallelSort(std::vector<Data> &data,
+                      std::vector<Data> &buffer,
+                      const std::size_t beginBlock,
+                      const std::size_t endBlock,
+                      const std::size_t threads) noexcept;
+
+    /// As parallelSort() for vectors, result is copied to data if needed.
+    void parallelSort(Data *const data,
+                      Data *const buffer,
+                      const std::size_t size,
+                      const std::size_t beginBlock,
+                      const std::size_t endBlock,
+                      const std::size_t threads) noexcept;
+
+    /// \return false on out of memory
+    bool parallelSort(std::vector<Data> &data,
+                      const std::size_t beginBlock,
+                      const std::size_t endBlock,
+                      const std::size_t threads) noexcept;
+
+    /// Buckets not greater than this are sorted by simdSortSmall() by sortInPlace().
+    constexpr std::size_t maxInPlaceComparisonSortSize = 4096;
+    static_assert(maxInPlaceComparisonSortSize <= maxSimdSortSmallSize, "");
+
+    /// Buckets not greater than this are sorted by LSD radix sort with buffer on stack by sortInPlace().
+    constexpr std::size_t maxInPlaceBufferSize = 16 * 1024;
+
+    /*!
+     * \brief Sort by blocks [beginBlock, endBlock) by in-place MSD radix sort.
+     *
+     * Elements are permuted to their buckets by cycles (American flag sort),
+     * buckets are sorted recursively, small buckets are sorted
+     * by simdSortSmall() or LSD radix sort with fixed size buffer.
+     * If threads > 1 buckets of the highest block are sorted in parallel.
+     *
+     * Auxiliary memory is O(buckets * blocks + maxInPlaceBufferSize) on stack.
+     */
+    void sortInPlace(Data *const data,
+                     const std::size_t size,
+                     const std::size_t beginBlock=0,
+                     const std::size_t endBlock=iterations,
+                     const std::size_t threads=1) noexcept;
+
+    /// Inputs of at most this number of sorted runs are merged by sortFile() instead of radix sort.
+    constexpr std::size_t maxMergeRuns = 2;
+
+    /*!
+     * \brief Sort file using parallelThreads().
+     *
+     * Source is read directly to shared mapping of destination
+     * which is used as one of radix buffers, so only radix scratch is allocated.
+     * Runs are detected while file is read.
+     * Sorted input is copied, reverse sorted is reversed,
+     * at most maxMergeRuns runs are merged.
+     * If radix scratch can not be allocated, sortInPlace() is used.
+     *
+     * \note source and destination may be one file,
+     * sorted file is not rewritten in that case
+     *
+     * \return runs detected in source
+     */
+    RunDetector sortFile(const boost::filesystem::path &source,
+                         const boost::filesystem::path &destination,
+                         const std::size_t beginBlock=0,
+                         const std::size_t endBlock=iterations);
+
+    /*!
+     * \brief Sort file by sortInPlace() in shared mapping of destination, no memory is allocated.
+     *
+     * Sorted and reverse sorted inputs are handled as by sortFile().
+     *
+     * \note source and destination may be one file
+     *
+     * \return runs detected in source
+     */
+    RunDetector sortFileInPlace(const boost::filesystem::path &source,
+                                const boost::filesystem::path &destination,
+                                const std::size_t beginBlock=0,
+                                const std::size_t endBlock=iterations);
 }}}}
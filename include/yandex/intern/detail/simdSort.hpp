@@ -0,0 +1,25 @@
+#pragma once
+
+#include "yandex/intern/types.hpp"
+
+namespace yandex{namespace intern{namespace detail
+{
+    /// Sizes not greater than this are sorted by simdSortSmall() without allocation.
+    constexpr std::size_t maxSimdSortSmallSize = 4096;
+
+    /*!
+     * \brief Sort by AVX2 sorting network and bitonic merges.
+     *
+     * Blocks of 64 elements are sorted by network of 8 registers,
+     * then sorted runs are merged by 8 elements.
+     * Falls back to std::sort if AVX2 is not supported.
+     *
+     * \return false on out of memory
+     */
+    bool simdSort(const Data *__restrict__ const src,
+                  Data *__restrict__ const dst,
+                  const std::size_t size) noexcept __attribute__((nonnull));
+
+    /// \warning size should not be greater than maxSimdSortSmallSize
+    void simdSortSmall(Data *const data, const std::size_t size) noexcept;
+}}}
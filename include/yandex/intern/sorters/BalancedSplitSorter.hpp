@@ -4,32 +4,147 @@
 #include "yandex/intern/types.hpp"
 
 #include "yandex/intern/detail/LockedStorage.hpp"
+#include "yandex/intern/detail/MemoryBudget.hpp"
+#include "yandex/intern/detail/PrefixHistogram.hpp"
+#include "yandex/intern/detail/PrefixRouter.hpp"
 #include "yandex/intern/detail/Queue.hpp"
+#include "yandex/intern/detail/RadixSorter.hpp"
+#include "yandex/intern/detail/RunDetector.hpp"
+#include "yandex/intern/detail/SequencedWriter.hpp"
 
 #include <boost/thread.hpp>
 
-#include <unordered_map>
+#include <atomic>
 #include <vector>
 
+#include <cstdint>
+
 namespace yandex{namespace intern{namespace sorters
 {
     class BalancedSplitSorter: public Sorter
     {
     public:
-        BalancedSplitSorter(const boost::filesystem::path& src, const boost::filesystem::path& dst);
+        /// How prefix mapping is built.
+        enum class PrefixSplitMode
+        {
+            automatic,  ///< sampling for big inputs, histogram otherwise
+            histogram,  ///< count every element, additional pass over input
+            sampling    ///< estimate from random blocks, parts may exceed limit
+        };
+
+    public:
+        BalancedSplitSorter(const boost::filesystem::path& src, const boost::filesystem::path& dst,
+                            const std::size_t memoryLimitBytes=defaultMemoryLimitBytes,
+                            const PrefixSplitMode prefixSplitMode=PrefixSplitMode::automatic);
         ~BalancedSplitSorter() override;
 
+        /// All parts opened simultaneously and their split buffers should fit into limits.
+        static bool isApplicable(const std::size_t inputByteSize, const std::size_t memoryLimitBytes);
+
+        /*!
+         * \brief Disk space used by temporary files and destination.
+         *
+         * \param inPlace source and destination are the same file
+         */
+        static std::size_t spaceRequired(const std::size_t inputByteSize, const bool inPlace);
+
+        /// Bytes read from source and temporary files by sort().
+        std::size_t bytesRead() const;
+
     protected:
         void sort() override;
 
     private:
+        /// Prefix tree node that is a part.
+        struct PrefixEnd
+        {
+            std::size_t prefix;
+            std::uint64_t size;
+        };
+
         void buildPrefixSplit();
-        void buildCompressedPrefixSplit();
+        detail::PrefixHistogram countPrefixes();
+        detail::PrefixHistogram samplePrefixes();
+        void buildCompressedPrefixSplit(std::vector<PrefixEnd> &ends);
+
+        /*!
+         * \brief Copy sorted or reverse sorted input to destination
+         * using inputRuns_ detected by the first pass.
+         *
+         * \return false if input should be split and merged
+         */
+        bool copyPresorted();
 
         void split();
 
+        /// Parts are merged by several threads at offsets computed from id2size_.
         void merge();
 
+        /*!
+         * \brief Radix sorter of merge worker.
+         *
+         * Its scratch is kept acquired from budget between parts,
+         * so only part memory is acquired per part.
+         */
+        class PartSorter: private boost::noncopyable
+        {
+        public:
+            explicit PartSorter(detail::MemoryBudget &budget);
+
+            /// Scratch is released.
+            ~PartSorter();
+
+            /*!
+             * \brief Acquire memory for part of size elements and scratch for it.
+             *
+             * If budget is not available scratch is released before waiting.
+             */
+            void acquire(const std::size_t size);
+
+            /// Release memory of part acquired by acquire().
+            void release(const std::size_t size);
+
+            /*!
+             * \brief Acquire memory not used for sorting.
+             *
+             * If budget is not available scratch is released before waiting.
+             */
+            void acquireBuffer(const std::size_t byteSize);
+
+            /// Release memory acquired by acquireBuffer().
+            void releaseBuffer(const std::size_t byteSize);
+
+            /// \throws std::bad_alloc if scratch can not be allocated
+            void sort(std::vector<Data> &data, const std::size_t endBlock, const std::size_t threads);
+
+        private:
+            void releaseScratch();
+
+        private:
+            detail::MemoryBudget &budget_;
+            detail::RadixSorter sorter_;
+            std::size_t scratchByteSize_ = 0;
+        };
+
+        /*!
+         * \brief Sort part and write it to output, part is removed.
+         *
+         * Part with at most 16 free bits is stored as HalfData suffixes and count sorted.
+         * Other part is sorted in memory if it fits
+         * or split recursively by next bits after common prefix.
+         * Memory for part sorted in memory is acquired from mergeMemory_,
+         * it is sorted by sorter using this thread and mergeIdleThreads_.
+         * Blocks of split are acquired from mergeMemory_ too,
+         * concurrent splits are limited by resplitDescriptors_.
+         *
+         * \param prefix common prefix of part elements stored with leading 1 bit
+         */
+        void mergePart(const boost::filesystem::path &part,
+                       const std::size_t size,
+                       const std::size_t prefix,
+                       detail::SequencedWriter &output,
+                       PartSorter &sorter);
+
     private /* helper threads */:
         void inputReader();
 
@@ -44,9 +159,21 @@ namespace yandex{namespace intern{namespace sorters
         void splitWorker();
 
     private:
+        const std::size_t maxPartSize_;
+        const std::size_t splitThreads_;
+        const std::size_t inputReaderBufferSize_;
+        detail::MemoryBudget mergeMemory_;
+        detail::MemoryBudget resplitDescriptors_; ///< counts descriptors instead of bytes
+        std::size_t partWriterBufferSize_ = 0; // computed by split()
+        const PrefixSplitMode prefixSplitMode_;
+        bool prefixSampling_ = false; // computed by sort() before inputReader() is started
+        std::atomic<std::size_t> bytesRead_{0};
+        std::atomic<std::size_t> mergeIdleThreads_{0}; ///< merge workers without parts left
+
         boost::thread inputReader_;
         detail::LockedStorage<std::vector<Data>> inputForBuildPrefixSplit_, inputForSplit_;
         std::size_t inputByteSize_; // write from inputReader() and read from merge() strictly after that
+        detail::RunDetector inputRuns_; // filled by inputReader() during the first pass over input
 
         boost::thread partWriter_;
         detail::Queue<PartWriteTask> partOutput_;
@@ -55,10 +182,9 @@ namespace yandex{namespace intern{namespace sorters
 
         const boost::filesystem::path root_;
         /// prefix is modified Data, it may be bigger at first steps
-        std::unordered_map<std::size_t, std::size_t> prefix2id_;
         std::vector<Data> id2prefix_;
+        detail::PrefixRouter prefixRouter_;
         std::vector<std::size_t> id2size_;
-        std::vector<bool> isEnd_;
         std::vector<bool> isCountSorted_;
         std::vector<boost::filesystem::path> id2part_;
 
@@ -7,7 +7,13 @@ namespace yandex{namespace intern{namespace sorters
     class InMemorySorter: public Sorter
     {
     public:
-        InMemorySorter(const boost::filesystem::path& src, const boost::filesystem::path& dst);
+        InMemorySorter(const boost::filesystem::path& src, const boost::filesystem::path& dst,
+                       const std::size_t memoryLimitBytes=defaultMemoryLimitBytes);
+
+        static std::size_t memoryRequired(const std::size_t inputByteSize);
+
+        /// Faster LSD radix sort is used if this amount of memory is available.
+        static std::size_t memoryPreferred(const std::size_t inputByteSize);
 
     protected:
         void sort() override;
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "yandex/intern/Sorter.hpp"
+#include "yandex/intern/types.hpp"
+
+#include "yandex/intern/detail/RadixSorter.hpp"
+#include "yandex/intern/detail/radixSort.hpp"
+
+#include <array>
+
+namespace yandex{namespace intern{namespace sorters
+{
+    /*!
+     * \brief Out-of-core in-place MSD radix sort of destination mapping.
+     *
+     * Source is copied to destination, the highest block is counted on the way.
+     * Mapping is permuted in place by blocks (American flag sort):
+     * every bucket cursor only moves forward and only a window
+     * around it is kept resident by madvise() hints.
+     * Buckets which fit in memory are sorted by detail::RadixSorter.
+     *
+     * No temporary files are used.
+     *
+     * \note Resident pages of mapping are clean or dirty page cache,
+     * window is at least 64 KiB since page faults map aligned blocks of that size.
+     */
+    class MappedRadixSorter: public Sorter
+    {
+    public:
+        MappedRadixSorter(const boost::filesystem::path &src, const boost::filesystem::path &dst,
+                          const std::size_t memoryLimitBytes=defaultMemoryLimitBytes);
+
+        /// Disk space used by destination, zero if sorted in place.
+        static std::size_t spaceRequired(const std::size_t inputByteSize, const bool inPlace);
+
+    protected:
+        void sort() override;
+
+    private:
+        typedef std::array<std::size_t, detail::radix::bucketsSize> Histogram;
+
+        /// \return number of elements
+        std::size_t copyCounting(const std::size_t block, Histogram &histogram);
+
+        void count(const Data *const data, const std::size_t size,
+                   const std::size_t block, Histogram &histogram);
+
+        /*!
+         * \brief Sort by blocks [0, endBlock).
+         *
+         * \param histogram of endBlock - 1 block, counted if nullptr
+         */
+        void sortRange(Data *const data, const std::size_t size,
+                       const std::size_t endBlock, const Histogram *histogram);
+
+        /// Move elements to their buckets by block, bucketEnd is filled with bucket bounds.
+        void permute(Data *const data, const std::size_t size, const std::size_t block,
+                     const Histogram &histogram, Histogram &bucketEnd);
+
+    private:
+        const std::size_t maxInMemorySize_; ///< elements of range and radix scratch fit in memory
+        const std::size_t windowSize_; ///< elements kept resident around every cursor
+        detail::RadixSorter sorter_;
+    };
+}}}
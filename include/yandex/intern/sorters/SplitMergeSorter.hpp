@@ -14,9 +14,23 @@ namespace yandex{namespace intern{namespace sorters
     class SplitMergeSorter: public Sorter
     {
     public:
-        SplitMergeSorter(const boost::filesystem::path& src, const boost::filesystem::path& dst);
+        /// How sorted runs are generated.
+        enum class RunGeneration
+        {
+            automatic,              ///< replacement selection if the first block is nearly sorted
+            blocks,                 ///< fixed size blocks are sorted and merged by pairs
+            replacementSelection    ///< runs of about 2x heap on random input, longer on partially ordered
+        };
+
+    public:
+        SplitMergeSorter(const boost::filesystem::path& src, const boost::filesystem::path& dst,
+                         const std::size_t memoryLimitBytes=defaultMemoryLimitBytes,
+                         const RunGeneration runGeneration=RunGeneration::automatic);
         ~SplitMergeSorter() override;
 
+        /// Disk space used by temporary files and destination.
+        static std::size_t spaceRequired(const std::size_t inputByteSize);
+
     protected:
         void sort() override;
 
@@ -24,20 +38,45 @@ namespace yandex{namespace intern{namespace sorters
         /// split + merge
         void main();
 
+        bool isNearlySorted();
+
         void split();
+
+        /*!
+         * \brief Merge runs minimizing data moved.
+         *
+         * The least runs are merged first as in k-ary Huffman code,
+         * the last merge writes to destination.
+         * While runs are generated, the least generated runs
+         * are merged early if no pass is added.
+         */
         void merge();
 
+        /// Stream source through heap, runs are passed to merge().
+        void replacementSelection();
+
         void sortSmall();
         void dumpSmall();
 
         template <typename Source>
         void mergeToFile(Source &source, const boost::filesystem::path &output);
 
+        /*!
+         * \brief Merge and remove sorted runs.
+         *
+         * Output is split into equal parts by detail::coRank(),
+         * parts are merged by threads at their offsets.
+         */
         void mergeFiles(const std::vector<boost::filesystem::path> &from,
                         const boost::filesystem::path &to);
 
     private:
         const boost::filesystem::path root_;
+        const std::size_t blockSize_; ///< in elements
+        const std::size_t mergeBufferByteSize_; ///< per merge input
+        const std::size_t mergeNumberLimit_;
+        const std::size_t heapSize_; ///< in elements
+        const RunGeneration runGeneration_;
         detail::Queue<std::vector<Data>> smallSortTasks_;
         detail::Queue<std::vector<Data>> dumpSmallTasks_;
         detail::Queue<boost::filesystem::path> mergeTasks_;
@@ -1,20 +1,82 @@
 #include "yandex/intern/Error.hpp"
 #include "yandex/intern/Sorter.hpp"
 
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+
 #include <iostream>
+#include <limits>
+
+namespace
+{
+    /// Parse size with optional binary suffix: K, M, G or T.
+    std::size_t parseByteSize(std::string size)
+    {
+        static const std::string suffixes = "KMGT";
+        const std::string value = size;
+        std::size_t shift = 0;
+        if (!size.empty())
+        {
+            const std::size_t pos = suffixes.find(size.back());
+            if (pos != std::string::npos)
+            {
+                shift = 10 * (pos + 1);
+                size.pop_back();
+            }
+        }
+        // lexical_cast wraps negative values
+        if (!size.empty() && size.front() == '-')
+            throw boost::program_options::invalid_option_value(value);
+        const std::size_t number = boost::lexical_cast<std::size_t>(size);
+        if (number > (std::numeric_limits<std::size_t>::max() >> shift))
+            throw boost::program_options::invalid_option_value(value);
+        return number << shift;
+    }
+}
 
 int main(int argc, char *argv[])
 {
     std::ios_base::sync_with_stdio(false);
-    if (argc != 2 + 1)
+    using namespace yandex::intern;
+    namespace po = boost::program_options;
+    std::string src, dst, memory;
+    Sorter::Algorithm algorithm;
+    po::options_description desc("Options");
+    desc.add_options()
+        ("help,h", "print this message")
+        ("memory,m", po::value<std::string>(&memory)->default_value(
+            boost::lexical_cast<std::string>(Sorter::defaultMemoryLimitBytes / (1024 * 1024)) + "M"),
+         "memory limit in bytes, K, M, G and T suffixes are supported")
+        ("algorithm,a", po::value<Sorter::Algorithm>(&algorithm)->default_value(Sorter::Algorithm::automatic),
+         "auto, in_memory, balanced_split, split_merge or mapped_radix")
+        ("src", po::value<std::string>(&src)->required(), "source file")
+        ("dst", po::value<std::string>(&dst)->required(), "destination file");
+    po::positional_options_description pdesc;
+    pdesc.add("src", 1).add("dst", 1);
+    std::size_t memoryLimitBytes;
+    try
+    {
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(pdesc).run(), vm);
+        if (vm.count("help"))
+        {
+            std::cerr << "Usage: " << argv[0] << " [options] ${src} ${dst}" << std::endl;
+            std::cerr << desc << std::endl;
+            return 0;
+        }
+        po::notify(vm);
+        memoryLimitBytes = parseByteSize(memory);
+    }
+    catch (std::exception &e)
     {
-        std::cerr << "Usage: " << argv[0] << " ${src} ${dst}" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " [options] ${src} ${dst}" << std::endl;
+        std::cerr << desc << std::endl;
+        std::cerr << "Error occurred: " << e.what() << std::endl;
         return 2;
     }
-    using namespace yandex::intern;
     try
     {
-        Sorter::sort(argv[1], argv[2]);
+        Sorter::sort(src, dst, memoryLimitBytes, algorithm);
     }
     catch (InvalidFileSizeError &e)
     {
@@ -24,6 +86,20 @@ int main(int argc, char *argv[])
         std::cerr << std::endl;
         return 4;
     }
+    catch (InvalidMemoryLimitError &)
+    {
+        std::cerr << "Error occurred: memory limit should be at least " <<
+                     Sorter::minMemoryLimitBytes << " bytes" << std::endl;
+        return 2;
+    }
+    catch (MemoryLimitExceededError &e)
+    {
+        std::cerr << "Error occurred: not enough memory";
+        if (e.get<MemoryLimitExceededError::memoryRequired>())
+            std::cerr << ", " << *e.get<MemoryLimitExceededError::memoryRequired>() << " bytes required";
+        std::cerr << std::endl;
+        return 2;
+    }
     catch (bunsan::system_error &e)
     {
         std::cerr << "Error occurred: ";
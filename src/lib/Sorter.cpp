@@ -1,20 +1,105 @@
 #include "yandex/intern/Sorter.hpp"
+#include "yandex/intern/Error.hpp"
 
 #include "yandex/intern/sorters/BalancedSplitSorter.hpp"
 #include "yandex/intern/sorters/InMemorySorter.hpp"
+#include "yandex/intern/sorters/MappedRadixSorter.hpp"
 #include "yandex/intern/sorters/SplitMergeSorter.hpp"
 
+#include "bunsan/logging/legacy.hpp"
+
+#include <boost/filesystem/operations.hpp>
+
+#include <istream>
+#include <ostream>
+#include <string>
+
 namespace yandex{namespace intern
 {
-    void Sorter::sort(const boost::filesystem::path &src, const boost::filesystem::path &dst)
+    constexpr std::size_t Sorter::defaultMemoryLimitBytes;
+    constexpr std::size_t Sorter::minMemoryLimitBytes;
+
+    namespace
+    {
+        Sorter::Algorithm planExternal(const boost::filesystem::path &src,
+                                       const boost::filesystem::path &dst,
+                                       const std::size_t inputByteSize,
+                                       const std::size_t memoryLimitBytes)
+        {
+            const boost::filesystem::path root = boost::filesystem::absolute(dst).parent_path();
+            const std::size_t spaceAvailable = boost::filesystem::space(root).available;
+            const bool inPlace = boost::filesystem::exists(dst) && boost::filesystem::equivalent(src, dst);
+
+            const std::size_t balancedSplitSpace = sorters::BalancedSplitSorter::spaceRequired(inputByteSize, inPlace);
+            const std::size_t splitMergeSpace = sorters::SplitMergeSorter::spaceRequired(inputByteSize);
+            // balanced split never requires more space, so space only decides fallback to mapped radix
+            BOOST_ASSERT(balancedSplitSpace <= splitMergeSpace);
+
+            Sorter::Algorithm algorithm = Sorter::Algorithm::splitMerge;
+            std::size_t spaceRequired = splitMergeSpace;
+            if (sorters::BalancedSplitSorter::isApplicable(inputByteSize, memoryLimitBytes))
+            {
+                algorithm = Sorter::Algorithm::balancedSplit;
+                spaceRequired = balancedSplitSpace;
+            }
+            // no temporary files at the cost of random access to destination
+            const std::size_t mappedRadixSpace = sorters::MappedRadixSorter::spaceRequired(inputByteSize, inPlace);
+            if (spaceRequired > spaceAvailable && mappedRadixSpace <= spaceAvailable)
+            {
+                algorithm = Sorter::Algorithm::mappedRadix;
+                spaceRequired = mappedRadixSpace;
+            }
+            if (spaceRequired > spaceAvailable)
+                SLOG("Warning: " << algorithm << " algorithm requires " << spaceRequired <<
+                     " bytes of disk space, only " << spaceAvailable << " are available in " << root << ".");
+            return algorithm;
+        }
+    }
+
+    void Sorter::sort(const boost::filesystem::path &src, const boost::filesystem::path &dst,
+                      const std::size_t memoryLimitBytes, Algorithm algorithm)
     {
-        intern::sort<sorters::BalancedSplitSorter>(src, dst);
-        //intern::sort<sorters::InMemorySorter>(src, dst);
-        //intern::sort<sorters::SplitMergeSorter>(src, dst);
+        if (algorithm == Algorithm::automatic)
+        {
+            algorithm = plan(src, dst, memoryLimitBytes);
+            SLOG("Using " << algorithm << " algorithm.");
+        }
+        switch (algorithm)
+        {
+        case Algorithm::inMemory:
+            intern::sort<sorters::InMemorySorter>(src, dst, memoryLimitBytes);
+            break;
+        case Algorithm::balancedSplit:
+            intern::sort<sorters::BalancedSplitSorter>(src, dst, memoryLimitBytes);
+            break;
+        case Algorithm::splitMerge:
+            intern::sort<sorters::SplitMergeSorter>(src, dst, memoryLimitBytes);
+            break;
+        case Algorithm::mappedRadix:
+            intern::sort<sorters::MappedRadixSorter>(src, dst, memoryLimitBytes);
+            break;
+        case Algorithm::automatic:
+            BOOST_ASSERT(false);
+        }
     }
 
-    Sorter::Sorter(const boost::filesystem::path &src, const boost::filesystem::path &dst):
-        source_(src), destination_(dst) {}
+    Sorter::Algorithm Sorter::plan(const boost::filesystem::path &src, const boost::filesystem::path &dst,
+                                   const std::size_t memoryLimitBytes)
+    {
+        const std::size_t inputByteSize = boost::filesystem::file_size(src);
+        if (sorters::InMemorySorter::memoryRequired(inputByteSize) <= memoryLimitBytes)
+            return Algorithm::inMemory;
+        return planExternal(src, dst, inputByteSize, memoryLimitBytes);
+    }
+
+    Sorter::Sorter(const boost::filesystem::path &src, const boost::filesystem::path &dst,
+                   const std::size_t memoryLimitBytes):
+        source_(src), destination_(dst), memoryLimitBytes_(memoryLimitBytes)
+    {
+        if (memoryLimitBytes_ < minMemoryLimitBytes)
+            BOOST_THROW_EXCEPTION(InvalidMemoryLimitError() <<
+                                  InvalidMemoryLimitError::memoryLimit(memoryLimitBytes_));
+    }
 
     Sorter::~Sorter() {}
 
@@ -27,4 +112,48 @@ namespace yandex{namespace intern
     {
         return destination_;
     }
+
+    std::size_t Sorter::memoryLimitBytes() const
+    {
+        return memoryLimitBytes_;
+    }
+
+    std::ostream &operator<<(std::ostream &out, const Sorter::Algorithm algorithm)
+    {
+        switch (algorithm)
+        {
+        case Sorter::Algorithm::automatic:
+            return out << "auto";
+        case Sorter::Algorithm::inMemory:
+            return out << "in_memory";
+        case Sorter::Algorithm::balancedSplit:
+            return out << "balanced_split";
+        case Sorter::Algorithm::splitMerge:
+            return out << "split_merge";
+        case Sorter::Algorithm::mappedRadix:
+            return out << "mapped_radix";
+        }
+        return out;
+    }
+
+    std::istream &operator>>(std::istream &in, Sorter::Algorithm &algorithm)
+    {
+        std::string name;
+        if (in >> name)
+        {
+            if (name == "auto")
+                algorithm = Sorter::Algorithm::automatic;
+            else if (name == "in_memory")
+                algorithm = Sorter::Algorithm::inMemory;
+            else if (name == "balanced_split")
+                algorithm = Sorter::Algorithm::balancedSplit;
+            else if (name == "split_merge")
+                algorithm = Sorter::Algorithm::splitMerge;
+            else if (name == "mapped_radix")
+                algorithm = Sorter::Algorithm::mappedRadix;
+            else
+                in.setstate(std::ios_base::failbit);
+        }
+        return in;
+    }
 }}
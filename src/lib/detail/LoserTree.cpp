@@ -0,0 +1,27 @@
+#include "yandex/intern/detail/LoserTree.hpp"
+
+#include <boost/assert.hpp>
+
+namespace yandex{namespace intern{namespace detail
+{
+    constexpr LoserTree::Key LoserTree::exhausted;
+
+    LoserTree::LoserTree(const std::vector<Key> &keys):
+        nodes_(keys.size())
+    {
+        BOOST_ASSERT(!keys.empty());
+        const std::size_t size = keys.size();
+        // winners of subtrees, leaves included
+        std::vector<Node> winners(2 * size);
+        for (std::size_t i = 0; i < size; ++i)
+            winners[size + i] = {keys[i], i};
+        for (std::size_t node = size - 1; node; --node)
+        {
+            const Node &left = winners[2 * node], &right = winners[2 * node + 1];
+            const bool leftWins = !(right.key < left.key);
+            winners[node] = leftWins ? left : right;
+            nodes_[node] = leftWins ? right : left;
+        }
+        winner_ = winners[1];
+    }
+}}}
@@ -0,0 +1,50 @@
+#include "yandex/intern/detail/MemoryBudget.hpp"
+
+#include <boost/assert.hpp>
+#include <boost/thread/locks.hpp>
+
+namespace yandex{namespace intern{namespace detail
+{
+    MemoryBudget::Guard::Guard(MemoryBudget &budget, const std::size_t size):
+        budget_(budget), size_(size)
+    {
+        budget_.acquire(size_);
+    }
+
+    MemoryBudget::Guard::~Guard()
+    {
+        budget_.release(size_);
+    }
+
+    MemoryBudget::MemoryBudget(const std::size_t limit): limit_(limit) {}
+
+    void MemoryBudget::acquire(const std::size_t size)
+    {
+        boost::unique_lock<boost::mutex> lk(lock_);
+        released_.wait(lk, [&]() { return !acquired_ || acquired_ + size <= limit_; });
+        acquired_ += size;
+    }
+
+    bool MemoryBudget::tryAcquire(const std::size_t size)
+    {
+        const boost::lock_guard<boost::mutex> lk(lock_);
+        if (acquired_ && acquired_ + size > limit_)
+            return false;
+        acquired_ += size;
+        return true;
+    }
+
+    void MemoryBudget::release(const std::size_t size)
+    {
+        const boost::lock_guard<boost::mutex> lk(lock_);
+        BOOST_ASSERT(size <= acquired_);
+        acquired_ -= size;
+        released_.notify_all();
+    }
+
+    std::size_t MemoryBudget::acquired() const
+    {
+        const boost::lock_guard<boost::mutex> lk(lock_);
+        return acquired_;
+    }
+}}}
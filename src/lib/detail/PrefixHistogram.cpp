@@ -0,0 +1,119 @@
+#include "yandex/intern/detail/PrefixHistogram.hpp"
+
+#include <boost/assert.hpp>
+
+#include <cmath>
+
+namespace yandex{namespace intern{namespace detail
+{
+    constexpr std::size_t PrefixHistogram::dataBitSize;
+    constexpr std::size_t PrefixHistogram::coarseBitSize;
+    constexpr std::size_t PrefixHistogram::fineBitSize;
+    constexpr std::size_t PrefixHistogram::refineBitSize;
+    constexpr std::size_t PrefixHistogram::coarseSize;
+    constexpr std::size_t PrefixHistogram::refineSize;
+    constexpr std::size_t PrefixHistogram::refineMask;
+    constexpr std::size_t PrefixHistogram::coarseByteSize;
+    constexpr std::size_t PrefixHistogram::refinedByteSize;
+    constexpr std::uint32_t PrefixHistogram::notRefined;
+
+    namespace
+    {
+        /// Scale counters proportionally, so their sum is equal to total.
+        void distribute(std::uint64_t *const counters, const std::size_t size, const std::uint64_t total)
+        {
+            std::uint64_t sum = 0;
+            for (std::size_t i = 0; i < size; ++i)
+                sum += counters[i];
+            BOOST_ASSERT(sum);
+            // cumulative rounding keeps sum exact
+            std::uint64_t prefix = 0, scaledPrefix = 0;
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                prefix += counters[i];
+                const std::uint64_t scaled = static_cast<std::uint64_t>(
+                    static_cast<long double>(prefix) * total / sum + 0.5);
+                counters[i] = scaled - scaledPrefix;
+                scaledPrefix = scaled;
+            }
+            BOOST_ASSERT(scaledPrefix == total);
+        }
+    }
+
+    PrefixHistogram::PrefixHistogram(const std::uint64_t refineThreshold, const std::size_t maxRefined):
+        refineThreshold_(refineThreshold),
+        maxRefined_(maxRefined),
+        coarse_(coarseSize),
+        coarse2refined_(coarseSize, notRefined)
+    {
+        BOOST_ASSERT(refineThreshold_);
+        // note: memory is not touched until refinement
+        fine_.reserve(maxRefined_ * refineSize);
+    }
+
+    void PrefixHistogram::merge(const PrefixHistogram &histogram)
+    {
+        for (std::size_t coarse = 0; coarse < coarseSize; ++coarse)
+        {
+            coarse_[coarse] += histogram.coarse_[coarse];
+            const std::uint32_t refined = histogram.coarse2refined_[coarse];
+            if (refined != notRefined)
+            {
+                if (!isRefined(coarse))
+                {
+                    coarse2refined_[coarse] = refinedNumber();
+                    fine_.resize(fine_.size() + refineSize);
+                }
+                std::uint64_t *const fine = fine_.data() + coarse2refined_[coarse] * refineSize;
+                const std::uint64_t *const fineFrom = histogram.fine_.data() + refined * refineSize;
+                for (std::size_t i = 0; i < refineSize; ++i)
+                    fine[i] += fineFrom[i];
+            }
+        }
+    }
+
+    void PrefixHistogram::finalize(const double scale)
+    {
+        for (std::size_t coarse = 0; coarse < coarseSize; ++coarse)
+        {
+            if (scale != 1)
+                coarse_[coarse] = static_cast<std::uint64_t>(std::llround(coarse_[coarse] * scale));
+            const std::uint32_t refined = coarse2refined_[coarse];
+            if (refined != notRefined)
+                distribute(fine_.data() + refined * refineSize, refineSize, coarse_[coarse]);
+        }
+    }
+
+    std::uint64_t PrefixHistogram::coarse(const std::size_t coarsePrefix) const
+    {
+        BOOST_ASSERT(coarsePrefix < coarseSize);
+        return coarse_[coarsePrefix];
+    }
+
+    bool PrefixHistogram::isRefined(const std::size_t coarsePrefix) const
+    {
+        BOOST_ASSERT(coarsePrefix < coarseSize);
+        return coarse2refined_[coarsePrefix] != notRefined;
+    }
+
+    std::uint64_t PrefixHistogram::fine(const std::size_t coarsePrefix, const std::size_t refinePrefix) const
+    {
+        BOOST_ASSERT(isRefined(coarsePrefix));
+        BOOST_ASSERT(refinePrefix < refineSize);
+        return fine_[coarse2refined_[coarsePrefix] * refineSize + refinePrefix];
+    }
+
+    std::size_t PrefixHistogram::refinedNumber() const
+    {
+        return fine_.size() / refineSize;
+    }
+
+    void PrefixHistogram::refine(const std::size_t coarse, const Data data)
+    {
+        BOOST_ASSERT(!isRefined(coarse));
+        coarse2refined_[coarse] = refinedNumber();
+        fine_.resize(fine_.size() + refineSize);
+        // current element is counted by fine counter, previous are distributed by finalize()
+        ++fine_[coarse2refined_[coarse] * refineSize + ((data >> (dataBitSize - fineBitSize)) & refineMask)];
+    }
+}}}
@@ -0,0 +1,124 @@
+#include "yandex/intern/detail/PrefixRouter.hpp"
+
+#include <boost/assert.hpp>
+
+#include <algorithm>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#   define YANDEX_INTERN_PREFIX_ROUTER_AVX2
+#   include <immintrin.h>
+#endif
+
+namespace yandex{namespace intern{namespace detail
+{
+    constexpr std::size_t PrefixRouter::dataBitSize;
+    constexpr std::size_t PrefixRouter::coarseBitSize;
+    constexpr std::size_t PrefixRouter::fineBitSize;
+    constexpr std::size_t PrefixRouter::refineBitSize;
+    constexpr std::size_t PrefixRouter::coarseSize;
+    constexpr std::size_t PrefixRouter::refineSize;
+    constexpr std::size_t PrefixRouter::refineMask;
+    constexpr std::size_t PrefixRouter::maxId;
+    constexpr std::uint32_t PrefixRouter::refinedFlag;
+    constexpr std::uint32_t PrefixRouter::notRouted;
+
+    namespace
+    {
+#ifdef YANDEX_INTERN_PREFIX_ROUTER_AVX2
+        const bool hasAvx2 = __builtin_cpu_supports("avx2");
+
+        /*!
+         * \brief Route coarse prefixes, refined flag is the sign bit.
+         *
+         * \return number of routed elements, multiple of 8
+         */
+        __attribute__((target("avx2")))
+        std::size_t routeCoarseAvx2(const std::uint32_t *const coarse2id,
+                                    const std::size_t coarseShift,
+                                    const Data *const data,
+                                    const std::size_t size,
+                                    std::uint32_t *const ids,
+                                    int &refinedMask)
+        {
+            const std::size_t vectorSize = 8;
+            const __m128i shift = _mm_cvtsi64_si128(coarseShift);
+            const int *const table = reinterpret_cast<const int *>(coarse2id);
+            __m256i refined = _mm256_setzero_si256();
+            std::size_t i = 0;
+            for (; i + vectorSize <= size; i += vectorSize)
+            {
+                const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+                const __m256i id = _mm256_i32gather_epi32(table, _mm256_srl_epi32(x, shift), sizeof(std::uint32_t));
+                refined = _mm256_or_si256(refined, id);
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(ids + i), id);
+            }
+            refinedMask = _mm256_movemask_ps(_mm256_castsi256_ps(refined));
+            return i;
+        }
+#endif
+    }
+
+    PrefixRouter::PrefixRouter(const std::vector<Data> &id2prefix):
+        coarse2id_(coarseSize, notRouted)
+    {
+        BOOST_ASSERT(id2prefix.size() <= maxId + 1);
+        for (std::size_t id = 0; id < id2prefix.size(); ++id)
+        {
+            const std::size_t prefix = id2prefix[id];
+            BOOST_ASSERT(prefix);
+            std::size_t depth = 0;
+            while (prefix >> (depth + 1))
+                ++depth;
+            BOOST_ASSERT(depth <= fineBitSize);
+            const std::size_t bits = prefix ^ (std::size_t(1) << depth);
+            if (depth <= coarseBitSize)
+            {
+                const std::size_t shift = coarseBitSize - depth;
+                std::fill_n(coarse2id_.begin() + (bits << shift), std::size_t(1) << shift, id);
+            }
+            else
+            {
+                const std::size_t coarse = bits >> (depth - coarseBitSize);
+                if (coarse2id_[coarse] == notRouted)
+                {
+                    coarse2id_[coarse] = refinedFlag | refinedNumber();
+                    fine2id_.resize(fine2id_.size() + refineSize, notRouted);
+                }
+                BOOST_ASSERT(coarse2id_[coarse] & refinedFlag);
+                const std::size_t refined = coarse2id_[coarse] & ~refinedFlag;
+                const std::size_t shift = fineBitSize - depth;
+                const std::size_t local = bits & ((std::size_t(1) << (depth - coarseBitSize)) - 1);
+                std::fill_n(fine2id_.begin() + ((refined << refineBitSize) | (local << shift)),
+                            std::size_t(1) << shift, id);
+            }
+        }
+        BOOST_ASSERT(std::find(coarse2id_.begin(), coarse2id_.end(), notRouted) == coarse2id_.end());
+        BOOST_ASSERT(std::find(fine2id_.begin(), fine2id_.end(), notRouted) == fine2id_.end());
+    }
+
+    void PrefixRouter::operator()(const Data *const data, const std::size_t size, std::uint32_t *const ids) const
+    {
+        std::size_t i = 0;
+#ifdef YANDEX_INTERN_PREFIX_ROUTER_AVX2
+        if (hasAvx2)
+        {
+            int refinedMask;
+            i = routeCoarseAvx2(coarse2id_.data(), dataBitSize - coarseBitSize, data, size, ids, refinedMask);
+            // second pass is needed only if refined prefixes were met
+            for (std::size_t j = 0; refinedMask && j < i; ++j)
+            {
+                if (ids[j] & refinedFlag)
+                    ids[j] = fine2id_[((ids[j] & ~refinedFlag) << refineBitSize) |
+                                      ((data[j] >> (dataBitSize - fineBitSize)) & refineMask)];
+            }
+        }
+#endif
+        for (; i < size; ++i)
+            ids[i] = (*this)(data[i]);
+    }
+
+    std::size_t PrefixRouter::refinedNumber() const
+    {
+        return fine2id_.size() / refineSize;
+    }
+}}}
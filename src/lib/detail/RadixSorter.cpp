@@ -0,0 +1,77 @@
+#include "yandex/intern/detail/RadixSorter.hpp"
+
+#include <exception>
+
+#include <sys/mman.h>
+
+namespace yandex{namespace intern{namespace detail
+{
+    constexpr std::size_t RadixSorter::hugePageSize;
+
+    RadixSorter::RadixSorter(const bool hugePages): hugePages_(hugePages) {}
+
+    bool RadixSorter::reserve(const std::size_t size) noexcept
+    {
+        if (size <= capacity())
+            return true;
+        std::size_t byteSize = size * sizeof(Data);
+        const bool huge = hugePages_ && byteSize >= hugePageSize;
+        if (huge)
+            byteSize = (byteSize + hugePageSize - 1) / hugePageSize * hugePageSize;
+        try
+        {
+            // contents are not preserved, old scratch is unmapped first to lower peak usage
+            release();
+            if (scratch_)
+                return false;
+            scratch_.map(byteSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1);
+        }
+        catch (std::exception &)
+        {
+            return false;
+        }
+#ifdef MADV_HUGEPAGE
+        // hint only, failure is not an error
+        if (huge)
+            madvise(scratch_.data(), scratch_.size(), MADV_HUGEPAGE);
+#endif
+        return true;
+    }
+
+    std::size_t RadixSorter::capacity() const noexcept
+    {
+        return scratch_ ? scratch_.size() / sizeof(Data) : 0;
+    }
+
+    void RadixSorter::release() noexcept
+    {
+        if (scratch_)
+        {
+            std::error_code ec;
+            scratch_.unmap(ec);
+        }
+    }
+
+    bool RadixSorter::sort(Data *const data,
+                           const std::size_t size,
+                           const std::size_t beginBlock,
+                           const std::size_t endBlock,
+                           const std::size_t threads) noexcept
+    {
+        // comparison sort does not use buffer
+        const bool small = beginBlock == 0 && endBlock == radix::iterations && size <= radix::maxComparisonSortSize;
+        if (!small && !reserve(size))
+            return false;
+        Data *const buffer = static_cast<Data *>(capacity() ? scratch_.data() : nullptr);
+        radix::parallelSort(data, buffer, size, beginBlock, endBlock, threads);
+        return true;
+    }
+
+    bool RadixSorter::sort(std::vector<Data> &data,
+                           const std::size_t beginBlock,
+                           const std::size_t endBlock,
+                           const std::size_t threads) noexcept
+    {
+        return sort(data.data(), data.size(), beginBlock, endBlock, threads);
+    }
+}}}
@@ -0,0 +1,84 @@
+#include "yandex/intern/detail/RunDetector.hpp"
+
+#include <ostream>
+
+namespace yandex{namespace intern{namespace detail
+{
+    constexpr std::size_t RunDetector::defaultMaxRuns;
+
+    RunDetector::RunDetector(const std::size_t maxRuns): maxRuns_(maxRuns) {}
+
+    void RunDetector::add(const Data *const data, const std::size_t size)
+    {
+        if (!size)
+            return;
+        const std::size_t descents = descents_;
+        Data previous = size_ ? last_ : data[0];
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            ascents_ += previous < data[i];
+            descents_ += data[i] < previous;
+            previous = data[i];
+        }
+        // positions are found by second scan of block while it is in cache
+        if (descents_ != descents && descents_ < maxRuns_)
+        {
+            previous = size_ ? last_ : data[0];
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                if (data[i] < previous)
+                    runStarts_.push_back(size_ + i);
+                previous = data[i];
+            }
+        }
+        size_ += size;
+        last_ = data[size - 1];
+    }
+
+    std::size_t RunDetector::size() const
+    {
+        return size_;
+    }
+
+    bool RunDetector::isSorted() const
+    {
+        return !descents_;
+    }
+
+    bool RunDetector::isReversed() const
+    {
+        return !ascents_;
+    }
+
+    std::size_t RunDetector::maxRuns() const
+    {
+        return maxRuns_;
+    }
+
+    std::size_t RunDetector::runs() const
+    {
+        return size_ ? descents_ + 1 : 0;
+    }
+
+    std::vector<std::size_t> RunDetector::runEnds() const
+    {
+        std::vector<std::size_t> ends;
+        if (runs() <= maxRuns_)
+        {
+            ends = runStarts_;
+            ends.push_back(size_);
+        }
+        return ends;
+    }
+
+    std::ostream &operator<<(std::ostream &out, const RunDetector &runs)
+    {
+        if (runs.isSorted())
+            return out << "sorted";
+        if (runs.isReversed())
+            return out << "reverse sorted";
+        if (runs.runs() <= runs.maxRuns())
+            return out << runs.runs() << " sorted runs";
+        return out << "unsorted, " << runs.runs() << " runs";
+    }
+}}}
@@ -47,6 +47,11 @@ namespace yandex{namespace intern{namespace detail
 
     std::size_t SequencedInputBuffer::read(char *const dst, const std::size_t size)
     {
+        if (!dataAvailable() && size > buffer_.size())
+        {
+            // buffer would only add a copy
+            return readDirect(dst, size);
+        }
         std::size_t read_ = 0;
         while (read_ < size && !eof()) // note: eof() calls fill() when needed
             read_ += readAvailable(dst + read_, size - read_);
@@ -66,6 +71,14 @@ namespace yandex{namespace intern{namespace detail
         return fstat(inFd_.get()).size;
     }
 
+    void SequencedInputBuffer::seek(const std::size_t offset)
+    {
+        BOOST_ASSERT(opened());
+        if (lseek(inFd_.get(), offset, SEEK_SET) < 0)
+            BOOST_THROW_EXCEPTION(SystemError("lseek") << info::fd(inFd_.get()));
+        pos_ = buffer_.size();
+    }
+
     bool SequencedInputBuffer::eof()
     {
         if (pos_ == buffer_.size())
@@ -104,19 +117,25 @@ namespace yandex{namespace intern{namespace detail
         BOOST_ASSERT(opened());
         const std::size_t size = dataAvailable();
         memmove(buffer_.data(), buffer_.data() + pos_, size);
-        std::size_t read_ = size;
-        while (inFd_ && read_ < buffer_.size())
+        const std::size_t read_ = size + readDirect(buffer_.data() + size, buffer_.size() - size);
+        buffer_.resize(read_);
+        buffer_.shrink_to_fit();
+        pos_ = 0;
+    }
+
+    std::size_t SequencedInputBuffer::readDirect(char *const dst, const std::size_t size)
+    {
+        std::size_t read_ = 0;
+        while (inFd_ && read_ < size)
         {
-            const ssize_t lastRead = ::read(inFd_.get(), buffer_.data() + read_, buffer_.size() - read_);
+            const ssize_t lastRead = ::read(inFd_.get(), dst + read_, size - read_);
             if (lastRead < 0)
                 BOOST_THROW_EXCEPTION(SystemError("read") << info::fd(inFd_.get()));
             if (lastRead == 0)
                 inFd_.close();
             read_ += lastRead;
         }
-        buffer_.resize(read_);
-        buffer_.shrink_to_fit();
-        pos_ = 0;
+        return read_;
     }
 
     std::size_t SequencedInputBuffer::dataAvailable() const
@@ -64,8 +64,21 @@ namespace yandex{namespace intern{namespace detail
             BOOST_THROW_EXCEPTION(contest::SystemError("ftruncate") << unistd::info::fd(outFd_.get()) << unistd::info::size(size));
     }
 
+    void SequencedOutputBuffer::seek(const std::size_t offset)
+    {
+        flush();
+        if (lseek(outFd_.get(), offset, SEEK_SET) < 0)
+            BOOST_THROW_EXCEPTION(contest::SystemError("lseek") << unistd::info::fd(outFd_.get()));
+    }
+
     void SequencedOutputBuffer::write(const char *const src, const std::size_t size)
     {
+        if (!pos_ && size > buffer_.size())
+        {
+            // buffer would only add a copy
+            writeDirect(src, size);
+            return;
+        }
         std::size_t written = 0;
         while (written < size)
         {
@@ -86,16 +99,21 @@ namespace yandex{namespace intern{namespace detail
     void SequencedOutputBuffer::flush()
     {
         BOOST_ASSERT(opened());
+        writeDirect(buffer_.data(), pos_);
+        pos_ = 0;
+    }
+
+    void SequencedOutputBuffer::writeDirect(const char *const src, const std::size_t size)
+    {
         std::size_t written = 0;
-        while (written < pos_)
+        while (written < size)
         {
-            ssize_t lastWritten = ::write(outFd_.get(), buffer_.data() + written, pos_ - written);
+            ssize_t lastWritten = ::write(outFd_.get(), src + written, size - written);
             if (lastWritten < 0)
                 BOOST_THROW_EXCEPTION(SystemError("write") << info::fd(outFd_.get()));
             BOOST_ASSERT(lastWritten);
             written += lastWritten;
         }
-        pos_ = 0;
     }
 
     void SequencedOutputBuffer::close()
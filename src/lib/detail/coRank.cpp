@@ -0,0 +1,64 @@
+#include "yandex/intern/detail/coRank.hpp"
+
+#include <boost/assert.hpp>
+
+#include <algorithm>
+#include <limits>
+
+namespace yandex{namespace intern{namespace detail
+{
+    namespace
+    {
+        /// Number of elements not greater than value.
+        std::size_t countNotGreater(const std::vector<SortedRun> &runs, const Data value)
+        {
+            std::size_t count = 0;
+            for (const SortedRun &run: runs)
+                count += std::upper_bound(run.data, run.data + run.size, value) - run.data;
+            return count;
+        }
+    }
+
+    std::vector<std::size_t> coRank(const std::vector<SortedRun> &runs, const std::size_t rank)
+    {
+        std::vector<std::size_t> offsets(runs.size());
+        std::size_t size = 0;
+        for (const SortedRun &run: runs)
+            size += run.size;
+        BOOST_ASSERT(rank <= size);
+        if (rank == size)
+        {
+            for (std::size_t i = 0; i < runs.size(); ++i)
+                offsets[i] = runs[i].size;
+            return offsets;
+        }
+        // the least value with at least rank + 1 elements not greater than it
+        Data begin = 0, end = std::numeric_limits<Data>::max();
+        while (begin < end)
+        {
+            const Data middle = begin + (end - begin) / 2;
+            if (countNotGreater(runs, middle) > rank)
+                end = middle;
+            else
+                begin = middle + 1;
+        }
+        std::size_t left = rank;
+        for (std::size_t i = 0; i < runs.size(); ++i)
+        {
+            const Data *const runEnd = runs[i].data + runs[i].size;
+            offsets[i] = std::lower_bound(runs[i].data, runEnd, begin) - runs[i].data;
+            left -= offsets[i];
+        }
+        for (std::size_t i = 0; i < runs.size() && left; ++i)
+        {
+            const Data *const runEnd = runs[i].data + runs[i].size;
+            const std::size_t equal = std::upper_bound(runs[i].data + offsets[i], runEnd, begin) -
+                                      (runs[i].data + offsets[i]);
+            const std::size_t taken = std::min(equal, left);
+            offsets[i] += taken;
+            left -= taken;
+        }
+        BOOST_ASSERT(!left);
+        return offsets;
+    }
+}}}
@@ -1,6 +1,7 @@
 #include "yandex/intern/detail/radixSort.hpp"
 #include "yandex/intern/detail/FileMemoryMap.hpp"
-#include "yandex/intern/detail/io.hpp"
+#include "yandex/intern/detail/RadixSorter.hpp"
+#include "yandex/intern/detail/simdSort.hpp"
 #include "yandex/intern/Error.hpp"
 
 #include "yandex/contest/SystemError.hpp"
@@ -13,10 +14,15 @@
 #include <boost/assert.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <boost/scope_exit.hpp>
+#include <boost/thread/thread.hpp>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <new>
+#include <type_traits>
 
+#include <cstdint>
 #include <cstring>
 
 #include <fcntl.h>
@@ -24,57 +30,698 @@
 
 #include <sys/mman.h>
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#   define YANDEX_INTERN_RADIX_STREAM
+#   include <immintrin.h>
+#endif
+
 namespace yandex{namespace intern{namespace detail{namespace radix
 {
     namespace unistd = yandex::contest::system::unistd;
 
-    void sortIteration(const Data *__restrict__ const src,
-                       Data *__restrict__ const dst,
-                       const std::size_t size,
-                       const std::size_t blockShift) noexcept
+    namespace
     {
-        const std::size_t bitShift = blockBitSize * blockShift;
+        /// Digits of DigitBitSize bits, the highest digit may be shorter.
+        template <std::size_t DigitBitSize>
+        struct Digits
+        {
+            static constexpr std::size_t number = (dataBitSize + DigitBitSize - 1) / DigitBitSize;
+            static constexpr std::size_t buckets = std::size_t(1) << DigitBitSize;
+            static constexpr Data mask = static_cast<Data>(buckets - 1);
+            /// histogram[digitShift * buckets + bucket]
+            static constexpr std::size_t histogramSize = number * buckets;
 
-        std::size_t bucketCapacity[bucketsSize], bucketSize[bucketsSize];
-        memset(bucketCapacity, 0, sizeof(bucketCapacity));
-        memset(bucketSize, 0, sizeof(bucketSize));
-        Data *buckets[bucketsSize];
+            static inline std::size_t digit(const Data value, const std::size_t digitShift) noexcept
+            {
+                return (value >> (DigitBitSize * digitShift)) & mask;
+            }
+        };
 
-        for (std::size_t i = 0; i < size; ++i)
+        /// Count digits [0, Number) of value, recursion is unrolled.
+        template <std::size_t DigitBitSize, std::size_t Number>
+        struct CountValue
+        {
+            static inline void count(std::size_t *const histogram, const Data value) noexcept
+            {
+                typedef Digits<DigitBitSize> D;
+                CountValue<DigitBitSize, Number - 1>::count(histogram, value);
+                ++histogram[(Number - 1) * D::buckets + D::digit(value, Number - 1)];
+            }
+        };
+
+        template <std::size_t DigitBitSize>
+        struct CountValue<DigitBitSize, 0>
         {
-            const std::size_t value = (src[i] >> bitShift) & mask;
-            ++bucketCapacity[value];
+            static inline void count(std::size_t *const, const Data) noexcept {}
+        };
+
+        /// Count digits [beginDigit, endDigit) of all elements by single pass.
+        template <std::size_t DigitBitSize>
+        void countDigits(const Data *__restrict__ const src,
+                         const std::size_t size,
+                         const std::size_t beginDigit,
+                         const std::size_t endDigit,
+                         std::size_t *__restrict__ const histogram) noexcept
+        {
+            typedef Digits<DigitBitSize> D;
+            std::fill_n(histogram, D::histogramSize, 0);
+            if (beginDigit == 0 && endDigit == D::number)
+            {
+                for (std::size_t i = 0; i < size; ++i)
+                    CountValue<DigitBitSize, D::number>::count(histogram, src[i]);
+            }
+            else
+            {
+                for (std::size_t i = 0; i < size; ++i)
+                {
+                    const Data value = src[i];
+                    for (std::size_t digitShift = beginDigit; digitShift < endDigit; ++digitShift)
+                        ++histogram[digitShift * D::buckets + D::digit(value, digitShift)];
+                }
+            }
         }
 
-        for (std::size_t i = 0, allocated = 0; i < bucketsSize; allocated += bucketCapacity[i++])
-            buckets[i] = dst + allocated;
+        /// Pass over digit with single non-empty bucket does not change order.
+        template <std::size_t DigitBitSize>
+        bool isTrivial(const std::size_t *const bucketCapacity, const std::size_t size) noexcept
+        {
+            for (std::size_t i = 0; i < Digits<DigitBitSize>::buckets; ++i)
+                if (bucketCapacity[i])
+                    return bucketCapacity[i] == size;
+            return true;
+        }
 
-        for (std::size_t i = 0; i < size; ++i)
+        /// Bucket i starts at dst + sum of previous capacities.
+        template <std::size_t DigitBitSize>
+        void allocateBuckets(Data *const dst,
+                             const std::size_t *__restrict__ const bucketCapacity,
+                             Data **__restrict__ const buckets) noexcept
+        {
+            for (std::size_t i = 0, allocated = 0; i < Digits<DigitBitSize>::buckets; allocated += bucketCapacity[i++])
+                buckets[i] = dst + allocated;
+        }
+
+        /// \param buckets are advanced past scattered elements
+        template <std::size_t DigitBitSize>
+        void scatterDirect(const Data *__restrict__ const src,
+                           const std::size_t size,
+                           const std::size_t digitShift,
+                           Data **__restrict__ const buckets) noexcept
+        {
+            typedef Digits<DigitBitSize> D;
+            for (std::size_t i = 0; i < size; ++i)
+                *buckets[D::digit(src[i], digitShift)]++ = src[i];
+        }
+
+        constexpr std::size_t cacheLineByteSize = 64;
+        constexpr std::size_t lineSize = cacheLineByteSize / sizeof(Data);
+
+        /// Staging lines should fit into L2 cache.
+        constexpr std::size_t maxStagingByteSize = 128 * 1024;
+
+        template <std::size_t DigitBitSize>
+        struct HasStaging
+        {
+            static constexpr bool value = Digits<DigitBitSize>::buckets * cacheLineByteSize <= maxStagingByteSize;
+        };
+
+#ifdef YANDEX_INTERN_RADIX_STREAM
+        const bool hasAvx = __builtin_cpu_supports("avx");
+
+        /// Copy aligned cache line bypassing cache.
+        __attribute__((target("avx")))
+        inline void streamLine(Data *const dst, const Data *const src) noexcept
+        {
+            static_assert(cacheLineByteSize == 2 * sizeof(__m256i), "");
+            __m256i *const to = reinterpret_cast<__m256i *>(dst);
+            const __m256i *const from = reinterpret_cast<const __m256i *>(src);
+            _mm256_stream_si256(to, _mm256_load_si256(from));
+            _mm256_stream_si256(to + 1, _mm256_load_si256(from + 1));
+        }
+
+        /*!
+         * \brief Scatter through cache line of every bucket.
+         *
+         * Full lines are written by non-temporal stores,
+         * so pass touches at most one cached line per bucket.
+         * Partial lines at bucket bounds are written by regular stores
+         * since they may be shared with neighbour buckets.
+         */
+        template <std::size_t DigitBitSize>
+        __attribute__((target("avx")))
+        void scatterWriteCombining(const Data *__restrict__ const src,
+                                   const std::size_t size,
+                                   const std::size_t digitShift,
+                                   Data *const *__restrict__ const bucketBegin) noexcept
+        {
+            typedef Digits<DigitBitSize> D;
+            static_assert(HasStaging<DigitBitSize>::value, "");
+            alignas(cacheLineByteSize) Data lines[D::buckets][lineSize];
+            // lines[i] is staged for lineDst[i]
+            Data *lineDst[D::buckets];
+            std::size_t linePos[D::buckets];
+            for (std::size_t i = 0; i < D::buckets; ++i)
+            {
+                const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(bucketBegin[i]);
+                linePos[i] = (address % cacheLineByteSize) / sizeof(Data);
+                lineDst[i] = bucketBegin[i] - linePos[i];
+            }
+
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                const std::size_t bucket = D::digit(src[i], digitShift);
+                lines[bucket][linePos[bucket]] = src[i];
+                if (++linePos[bucket] == lineSize)
+                {
+                    if (lineDst[bucket] >= bucketBegin[bucket])
+                        streamLine(lineDst[bucket], lines[bucket]);
+                    else
+                        std::copy(lines[bucket] + (bucketBegin[bucket] - lineDst[bucket]),
+                                  lines[bucket] + lineSize, bucketBegin[bucket]);
+                    lineDst[bucket] += lineSize;
+                    linePos[bucket] = 0;
+                }
+            }
+
+            for (std::size_t i = 0; i < D::buckets; ++i)
+            {
+                const std::size_t first = lineDst[i] < bucketBegin[i] ? bucketBegin[i] - lineDst[i] : 0;
+                if (first < linePos[i])
+                    std::copy(lines[i] + first, lines[i] + linePos[i], lineDst[i] + first);
+            }
+            // non-temporal stores should be visible to other threads
+            _mm_sfence();
+        }
+#endif
+
+        /// Whether scatterWriteCombining() is used for size elements.
+        template <std::size_t DigitBitSize>
+        bool isWriteCombining(const Scatter scatter, const std::size_t size) noexcept
+        {
+#ifdef YANDEX_INTERN_RADIX_STREAM
+            if (!HasStaging<DigitBitSize>::value || !hasAvx)
+                return false;
+            switch (scatter)
+            {
+            case Scatter::automatic:
+                return size >= minWriteCombiningSize;
+            case Scatter::direct:
+                return false;
+            case Scatter::writeCombining:
+                return true;
+            }
+#endif
+            return false;
+        }
+
+        /*!
+         * \brief Scatter to buckets starting at given positions.
+         *
+         * Only HasStaging digits are scattered by write-combining.
+         *
+         * \param buckets may be advanced
+         */
+        template <std::size_t DigitBitSize>
+        typename std::enable_if<HasStaging<DigitBitSize>::value>::type
+        scatter(const Data *__restrict__ const src,
+                const std::size_t size,
+                const std::size_t digitShift,
+                Data **__restrict__ const buckets,
+                const bool writeCombining) noexcept
+        {
+#ifdef YANDEX_INTERN_RADIX_STREAM
+            if (writeCombining)
+            {
+                scatterWriteCombining<DigitBitSize>(src, size, digitShift, buckets);
+                return;
+            }
+#endif
+            scatterDirect<DigitBitSize>(src, size, digitShift, buckets);
+        }
+
+        template <std::size_t DigitBitSize>
+        typename std::enable_if<!HasStaging<DigitBitSize>::value>::type
+        scatter(const Data *__restrict__ const src,
+                const std::size_t size,
+                const std::size_t digitShift,
+                Data **__restrict__ const buckets,
+                const bool /*writeCombining*/) noexcept
+        {
+            scatterDirect<DigitBitSize>(src, size, digitShift, buckets);
+        }
+
+        /// Number of non-trivial passes over digits [beginDigit, endDigit).
+        template <std::size_t DigitBitSize>
+        std::size_t passes(const std::size_t size,
+                           const std::size_t beginDigit,
+                           const std::size_t endDigit,
+                           const std::size_t *const histogram) noexcept
+        {
+            typedef Digits<DigitBitSize> D;
+            std::size_t passes = 0;
+            for (std::size_t digitShift = beginDigit; digitShift < endDigit; ++digitShift)
+                if (!isTrivial<DigitBitSize>(histogram + digitShift * D::buckets, size))
+                    ++passes;
+            return passes;
+        }
+
+        /*!
+         * \brief Run non-trivial passes alternating first and second as destination.
+         *
+         * \return pointer to sorted data: src if there are no passes, first or second otherwise
+         */
+        template <std::size_t DigitBitSize>
+        const Data *sortDigits(const Data *const src,
+                               Data *const first,
+                               Data *const second,
+                               const std::size_t size,
+                               const std::size_t beginDigit,
+                               const std::size_t endDigit,
+                               const std::size_t *const histogram,
+                               Data **const buckets,
+                               const bool writeCombining) noexcept
+        {
+            typedef Digits<DigitBitSize> D;
+            const Data *from = src;
+            Data *to = first;
+            for (std::size_t digitShift = beginDigit; digitShift < endDigit; ++digitShift)
+            {
+                const std::size_t *const bucketCapacity = histogram + digitShift * D::buckets;
+                if (!isTrivial<DigitBitSize>(bucketCapacity, size))
+                {
+                    allocateBuckets<DigitBitSize>(to, bucketCapacity, buckets);
+                    scatter<DigitBitSize>(from, size, digitShift, buckets, writeCombining);
+                    from = to;
+                    to = to == first ? second : first;
+                }
+            }
+            return from;
+        }
+
+        /// Workspace is allocated on stack, for small digits only.
+        template <std::size_t DigitBitSize>
+        void sortVector(std::vector<Data> &data,
+                        std::vector<Data> &buffer,
+                        const std::size_t beginDigit,
+                        const std::size_t endDigit) noexcept
+        {
+            typedef Digits<DigitBitSize> D;
+            static_assert(D::histogramSize * sizeof(std::size_t) <= 64 * 1024, "");
+            BOOST_ASSERT(data.size() == buffer.size());
+            BOOST_ASSERT(beginDigit <= endDigit && endDigit <= D::number);
+            std::size_t histogram[D::histogramSize];
+            Data *buckets[D::buckets];
+            countDigits<DigitBitSize>(data.data(), data.size(), beginDigit, endDigit, histogram);
+            const Data *const sorted = sortDigits<DigitBitSize>(
+                data.data(), buffer.data(), data.data(), data.size(), beginDigit, endDigit, histogram, buckets,
+                isWriteCombining<DigitBitSize>(Scatter::automatic, data.size()));
+            if (sorted != data.data())
+                data.swap(buffer);
+        }
+
+        /// As sortVector() for external buffer, result is copied to data if needed.
+        template <std::size_t DigitBitSize>
+        void sortRange(Data *const data,
+                       Data *const buffer,
+                       const std::size_t size,
+                       const std::size_t beginDigit,
+                       const std::size_t endDigit) noexcept
+        {
+            typedef Digits<DigitBitSize> D;
+            static_assert(D::histogramSize * sizeof(std::size_t) <= 64 * 1024, "");
+            BOOST_ASSERT(beginDigit <= endDigit && endDigit <= D::number);
+            std::size_t histogram[D::histogramSize];
+            Data *buckets[D::buckets];
+            countDigits<DigitBitSize>(data, size, beginDigit, endDigit, histogram);
+            const Data *const sorted = sortDigits<DigitBitSize>(
+                data, buffer, data, size, beginDigit, endDigit, histogram, buckets,
+                isWriteCombining<DigitBitSize>(Scatter::automatic, size));
+            if (sorted != data)
+                memcpy(data, sorted, size * sizeof(Data));
+        }
+
+        /*!
+         * \brief Run task by calling thread and at most threads - 1 additional ones.
+         *
+         * Task should take work from shared queue,
+         * so it is completed even if threads can not be created.
+         */
+        template <typename Task>
+        void runThreads(const std::size_t threads, const Task &task) noexcept
+        {
+            boost::thread_group workers;
+            try
+            {
+                for (std::size_t i = 1; i < threads; ++i)
+                    workers.create_thread([&task]() { task(); });
+            }
+            catch (std::exception &)
+            {
+                // fewer threads do the same work
+            }
+            task();
+            workers.join_all();
+        }
+
+        /// Sort src by digits [beginDigit, endDigit) into dst, src is used as buffer.
+        template <std::size_t DigitBitSize>
+        void sortBucket(Data *const src,
+                        Data *const dst,
+                        const std::size_t size,
+                        const std::size_t beginDigit,
+                        const std::size_t endDigit) noexcept
+        {
+            typedef Digits<DigitBitSize> D;
+            std::size_t histogram[D::histogramSize];
+            Data *buckets[D::buckets];
+            countDigits<DigitBitSize>(src, size, beginDigit, endDigit, histogram);
+            const Data *const sorted = sortDigits<DigitBitSize>(
+                src, dst, src, size, beginDigit, endDigit, histogram, buckets,
+                isWriteCombining<DigitBitSize>(Scatter::automatic, size));
+            if (sorted != dst)
+                memcpy(dst, sorted, size * sizeof(Data));
+        }
+
+        /*!
+         * \brief Permute data so elements are grouped by block in bucket order.
+         *
+         * \param bucketEnd is filled with bucket bounds
+         * \return false if pass is trivial, data is not modified in that case
+         */
+        bool permuteBlock(Data *const data,
+                          const std::size_t size,
+                          const std::size_t block,
+                          std::size_t *const bucketEnd) noexcept
+        {
+            typedef Digits<blockBitSize> D;
+            std::size_t bucketCapacity[D::buckets] = {};
+            for (std::size_t i = 0; i < size; ++i)
+                ++bucketCapacity[D::digit(data[i], block)];
+            if (isTrivial<blockBitSize>(bucketCapacity, size))
+                return false;
+            std::size_t head[D::buckets];
+            for (std::size_t i = 0, allocated = 0; i < D::buckets; ++i)
+            {
+                head[i] = allocated;
+                allocated += bucketCapacity[i];
+                bucketEnd[i] = allocated;
+            }
+            // every element is moved at most once to its bucket
+            for (std::size_t bucket = 0; bucket < D::buckets; ++bucket)
+            {
+                while (head[bucket] < bucketEnd[bucket])
+                {
+                    Data value = data[head[bucket]];
+                    std::size_t to = D::digit(value, block);
+                    while (to != bucket)
+                    {
+                        // hardware prefetcher does not follow so many streams
+                        __builtin_prefetch(data + head[to] + 2 * lineSize, 1);
+                        std::swap(value, data[head[to]++]);
+                        to = D::digit(value, block);
+                    }
+                    data[head[bucket]++] = value;
+                }
+            }
+            return true;
+        }
+
+        /// Sort small data by LSD radix sort using buffer on stack.
+        __attribute__((noinline))
+        void sortSmallBlocks(Data *const data,
+                             const std::size_t size,
+                             const std::size_t beginBlock,
+                             const std::size_t endBlock) noexcept
+        {
+            typedef Digits<blockBitSize> D;
+            BOOST_ASSERT(size <= maxInPlaceBufferSize);
+            Data buffer[maxInPlaceBufferSize];
+            std::size_t histogram[D::histogramSize];
+            Data *buckets[D::buckets];
+            countDigits<blockBitSize>(data, size, beginBlock, endBlock, histogram);
+            const Data *const sorted = sortDigits<blockBitSize>(
+                data, buffer, data, size, beginBlock, endBlock, histogram, buckets, false);
+            if (sorted != data)
+                memcpy(data, sorted, size * sizeof(Data));
+        }
+
+        /// \return true if blocks [block, iterations) are equal for all elements.
+        bool isCommonPrefix(const Data *const data, const std::size_t size, const std::size_t block) noexcept
+        {
+            if (block >= iterations || !size)
+                return true;
+            const std::size_t shift = block * blockBitSize;
+            const Data prefix = data[0] >> shift;
+            for (std::size_t i = 1; i < size; ++i)
+                if ((data[i] >> shift) != prefix)
+                    return false;
+            return true;
+        }
+
+        /// Sort by blocks [beginBlock, endBlock) by in-place MSD radix sort.
+        void sortInPlaceBlocks(Data *const data,
+                               const std::size_t size,
+                               const std::size_t beginBlock,
+                               std::size_t endBlock) noexcept
+        {
+            typedef Digits<blockBitSize> D;
+            // whole values are compared, blocks from endBlock may differ in top level range
+            if (size <= maxInPlaceComparisonSortSize && isCommonPrefix(data, size, endBlock))
+            {
+                simdSortSmall(data, size);
+                return;
+            }
+            if (size <= maxInPlaceBufferSize)
+            {
+                sortSmallBlocks(data, size, beginBlock, endBlock);
+                return;
+            }
+            std::size_t bucketEnd[D::buckets];
+            for (; beginBlock < endBlock; --endBlock)
+            {
+                if (permuteBlock(data, size, endBlock - 1, bucketEnd))
+                {
+                    for (std::size_t bucket = 0, begin = 0; bucket < D::buckets; begin = bucketEnd[bucket++])
+                        sortInPlaceBlocks(data + begin, bucketEnd[bucket] - begin, beginBlock, endBlock - 1);
+                    return;
+                }
+            }
+        }
+
+        /// Elements read at once, run detection scans them while they are in cache.
+        constexpr std::size_t readBlockSize = 64 * 1024;
+
+        /// Read size elements from fd to data, runs are detected block by block.
+        void readDetecting(const int fd, Data *const data, const std::size_t size, RunDetector &runs)
+        {
+            for (std::size_t begin = 0; begin < size; begin += readBlockSize)
+            {
+                const std::size_t blockSize = std::min(readBlockSize, size - begin);
+                char *const block = reinterpret_cast<char *>(data + begin);
+                const std::size_t blockByteSize = blockSize * sizeof(Data);
+                for (std::size_t read_ = 0; read_ < blockByteSize;)
+                {
+                    const ssize_t lastRead = ::read(fd, block + read_, blockByteSize - read_);
+                    if (lastRead < 0)
+                        BOOST_THROW_EXCEPTION(contest::SystemError("read") << unistd::info::fd(fd));
+                    if (lastRead == 0)
+                        BOOST_THROW_EXCEPTION(InvalidFileSizeError());
+                    read_ += lastRead;
+                }
+                runs.add(data + begin, blockSize);
+            }
+        }
+
+        /// Merge sorted runs pairwise, \return false if buffer can not be allocated.
+        bool mergeRuns(Data *const data, const std::size_t size, std::vector<std::size_t> ends) noexcept
+        {
+            try
+            {
+                std::unique_ptr<Data[]> buffer(new Data[size]);
+                std::vector<std::size_t> merged;
+                merged.reserve(ends.size());
+                Data *from = data, *to = buffer.get();
+                while (ends.size() > 1)
+                {
+                    merged.clear();
+                    for (std::size_t i = 0, begin = 0; i < ends.size(); i += 2)
+                    {
+                        const std::size_t end = ends[std::min(i + 1, ends.size() - 1)];
+                        std::merge(from + begin, from + ends[i], from + ends[i], from + end, to + begin);
+                        merged.push_back(end);
+                        begin = end;
+                    }
+                    std::swap(from, to);
+                    ends.swap(merged);
+                }
+                if (from != data)
+                    memcpy(data, from, size * sizeof(Data));
+                return true;
+            }
+            catch (std::bad_alloc &)
+            {
+                return false;
+            }
+        }
+
+        /*!
+         * \brief Sort data using structure found by run detection.
+         *
+         * \param merge allows merge of runs which requires buffer
+         *
+         * \return false if data was not sorted
+         */
+        bool sortPresorted(Data *const data, const std::size_t size, const RunDetector &runs,
+                           const std::size_t beginBlock, const std::size_t endBlock, const bool merge)
+        {
+            // partial keys are not ordered as full values
+            if (beginBlock != 0 || endBlock != iterations)
+                return false;
+            if (runs.isSorted())
+                return true;
+            if (runs.isReversed())
+            {
+                std::reverse(data, data + size);
+                return true;
+            }
+            if (merge && runs.runs() <= maxMergeRuns)
+                return mergeRuns(data, size, runs.runEnds());
+            return false;
+        }
+
+        /*!
+         * \brief Sort file in shared mapping of destination.
+         *
+         * Source is read directly to destination mapping,
+         * in-place source is mapped as is.
+         * Pages which are not modified are not written.
+         *
+         * \param sort is called for mapped data and detected runs
+         *
+         * \return runs detected while reading
+         */
+        template <typename Sort>
+        RunDetector sortFileBy(const boost::filesystem::path &source,
+                               const boost::filesystem::path &destination,
+                               const Sort &sort)
         {
-            const std::size_t value = (src[i] >> bitShift) & mask;
-            buckets[value][bucketSize[value]++] = src[i];
+            RunDetector runs(std::max(maxMergeRuns, RunDetector::defaultMaxRuns));
+            const bool inPlace = boost::filesystem::exists(destination) &&
+                                 boost::filesystem::equivalent(source, destination);
+            try
+            {
+                FileMemoryMap map;
+                if (inPlace)
+                {
+                    map.open(source, O_RDWR);
+                    if (map.fileSize() % sizeof(Data) != 0)
+                        BOOST_THROW_EXCEPTION(InvalidFileSizeError());
+                    const std::size_t size = map.fileSize() / sizeof(Data);
+                    if (!size)
+                        return runs;
+                    map.mapFull(PROT_READ | PROT_WRITE, MAP_SHARED);
+                    Data *const data = static_cast<Data *>(map.data());
+                    for (std::size_t begin = 0; begin < size; begin += readBlockSize)
+                        runs.add(data + begin, std::min(readBlockSize, size - begin));
+                    sort(data, size, runs);
+                }
+                else
+                {
+                    const unistd::Descriptor input = unistd::open(source, O_RDONLY);
+                    const std::size_t byteSize = unistd::fstat(input.get()).size;
+                    if (byteSize % sizeof(Data) != 0)
+                        BOOST_THROW_EXCEPTION(InvalidFileSizeError());
+                    map.open(destination, O_RDWR | O_CREAT | O_TRUNC);
+                    map.truncate(byteSize);
+                    const std::size_t size = byteSize / sizeof(Data);
+                    if (!size)
+                        return runs;
+                    map.mapFull(PROT_READ | PROT_WRITE, MAP_SHARED);
+                    Data *const data = static_cast<Data *>(map.data());
+                    readDetecting(input.get(), data, size, runs);
+                    sort(data, size, runs);
+                }
+                map.close();
+            }
+            catch (InvalidFileSizeError &e)
+            {
+                e << InvalidFileSizeError::path(source);
+                throw;
+            }
+            return runs;
+        }
+    }
+    template <std::size_t DigitBitSize, Scatter ScatterMode>
+    bool sortMemoryDigits(const Data *__restrict__ const src,
+                          Data *__restrict__ const dst,
+                          const std::size_t size) noexcept
+    {
+        typedef Digits<DigitBitSize> D;
+        try
+        {
+            std::vector<std::size_t> histogram(D::histogramSize);
+            std::vector<Data *> buckets(D::buckets);
+            countDigits<DigitBitSize>(src, size, 0, D::number, histogram.data());
+            const std::size_t passes_ = passes<DigitBitSize>(size, 0, D::number, histogram.data());
+            if (!passes_)
+            {
+                memcpy(dst, src, size * sizeof(Data));
+                return true;
+            }
+            std::unique_ptr<Data[]> buffer(new Data[size]);
+            // the last pass writes to dst
+            Data *const first = passes_ % 2 == 0 ? buffer.get() : dst;
+            Data *const second = first == dst ? buffer.get() : dst;
+            const Data *const sorted = sortDigits<DigitBitSize>(
+                src, first, second, size, 0, D::number, histogram.data(), buckets.data(),
+                isWriteCombining<DigitBitSize>(ScatterMode, size));
+            BOOST_ASSERT(sorted == dst);
+            return true;
+        }
+        catch (std::bad_alloc &)
+        {
+            return false;
         }
     }
 
+    template bool sortMemoryDigits<8, Scatter::automatic>(const Data *, Data *, std::size_t) noexcept;
+    template bool sortMemoryDigits<8, Scatter::direct>(const Data *, Data *, std::size_t) noexcept;
+    template bool sortMemoryDigits<8, Scatter::writeCombining>(const Data *, Data *, std::size_t) noexcept;
+    template bool sortMemoryDigits<11, Scatter::automatic>(const Data *, Data *, std::size_t) noexcept;
+    template bool sortMemoryDigits<11, Scatter::direct>(const Data *, Data *, std::size_t) noexcept;
+    template bool sortMemoryDigits<11, Scatter::writeCombining>(const Data *, Data *, std::size_t) noexcept;
+    template bool sortMemoryDigits<16, Scatter::automatic>(const Data *, Data *, std::size_t) noexcept;
+
+    bool sortMemoryAdaptive(const Data *__restrict__ const src,
+                            Data *__restrict__ const dst,
+                            const std::size_t size) noexcept
+    {
+        if (size <= maxComparisonSortSize)
+            return simdSort(src, dst, size);
+        if (size < minWideDigitSize)
+            return sortMemoryDigits<blockBitSize>(src, dst, size);
+        return sortMemoryDigits<wideDigitBitSize>(src, dst, size);
+    }
+
+    void sortIteration(const Data *__restrict__ const src,
+                       Data *__restrict__ const dst,
+                       const std::size_t size,
+                       const std::size_t blockShift) noexcept
+    {
+        std::size_t bucketCapacity[bucketsSize];
+        Data *buckets[bucketsSize];
+        memset(bucketCapacity, 0, sizeof(bucketCapacity));
+        for (std::size_t i = 0; i < size; ++i)
+            ++bucketCapacity[Digits<blockBitSize>::digit(src[i], blockShift)];
+        allocateBuckets<blockBitSize>(dst, bucketCapacity, buckets);
+        scatterDirect<blockBitSize>(src, size, blockShift, buckets);
+    }
+
     bool sortMemory(const Data *__restrict__ const src,
                     Data *__restrict__ const dst,
                     const std::size_t size) noexcept
     {
-        Data *const buffer = new (std::nothrow) Data[size];
-        if (!buffer)
-            return false;
-
-        const Data *from = src;
-        Data *to = iterations % 2 == 0 ? buffer : dst;
-        for (std::size_t blockShift = 0; blockShift < iterations; ++blockShift)
-        {
-            sortIteration(from, to, size, blockShift);
-            from = to;
-            to = to == buffer ? dst : buffer;
-        }
-        BOOST_ASSERT(from == dst);
-        delete [] buffer;
-        return true;
+        return sortMemoryDigits<blockBitSize>(src, dst, size);
     }
 
     void sort(std::vector<Data> &data,
@@ -82,25 +729,38 @@ namespace yandex{namespace intern{namespace detail{namespace radix
               const std::size_t beginBlock,
               const std::size_t endBlock) noexcept
     {
-        using std::swap;
-
-        const std::size_t size = data.size();
-        BOOST_ASSERT(size == buffer.size());
-        Data *from = data.data();
-        Data *to = buffer.data();
-        for (std::size_t blockShift = beginBlock; blockShift < endBlock; ++blockShift)
-        {
-            sortIteration(from, to, size, blockShift);
-            swap(from, to);
-        }
-        if (from != data.data())
-            swap(data, buffer);
+        if (beginBlock == 0 && endBlock == iterations)
+            sort(data, buffer);
+        else
+            sortVector<blockBitSize>(data, buffer, beginBlock, endBlock);
     }
 
     void sort(std::vector<Data> &data,
               std::vector<Data> &buffer) noexcept
     {
-        sort(data, buffer, 0, iterations);
+        BOOST_ASSERT(data.size() == buffer.size());
+        if (data.size() <= maxComparisonSortSize)
+            simdSortSmall(data.data(), data.size());
+        else if (data.size() < minWideDigitSize)
+            sortVector<blockBitSize>(data, buffer, 0, iterations);
+        else
+            sortVector<wideDigitBitSize>(data, buffer, 0, Digits<wideDigitBitSize>::number);
+    }
+
+    void sort(Data *const data,
+              Data *const buffer,
+              const std::size_t size,
+              const std::size_t beginBlock,
+              const std::size_t endBlock) noexcept
+    {
+        if (beginBlock != 0 || endBlock != iterations)
+            sortRange<blockBitSize>(data, buffer, size, beginBlock, endBlock);
+        else if (size <= maxComparisonSortSize)
+            simdSortSmall(data, size);
+        else if (size < minWideDigitSize)
+            sortRange<blockBitSize>(data, buffer, size, 0, iterations);
+        else
+            sortRange<wideDigitBitSize>(data, buffer, size, 0, Digits<wideDigitBitSize>::number);
     }
 
     bool sort(std::vector<Data> &data,
@@ -121,41 +781,201 @@ namespace yandex{namespace intern{namespace detail{namespace radix
 
     bool sort(std::vector<Data> &data) noexcept
     {
-        return sort(data, 0, iterations);
+        try
+        {
+            std::vector<Data> buffer(data.size());
+            sort(data, buffer);
+            return true;
+        }
+        catch (std::bad_alloc &)
+        {
+            return false;
+        }
+    }
+
+    std::size_t parallelThreads() noexcept
+    {
+        return std::max(boost::thread::hardware_concurrency(), 1u);
+    }
+
+    void parallelSort(std::vector<Data> &data,
+                      std::vector<Data> &buffer,
+                      const std::size_t beginBlock,
+                      const std::size_t endBlock,
+                      const std::size_t threads) noexcept
+    {
+        BOOST_ASSERT(data.size() == buffer.size());
+        // vectors are swapped instead of copy
+        if (std::min(threads, data.size() / minParallelPartSize) <= 1 || beginBlock == endBlock)
+            sort(data, buffer, beginBlock, endBlock);
+        else
+            parallelSort(data.data(), buffer.data(), data.size(), beginBlock, endBlock, threads);
     }
 
-    void sortFile(const boost::filesystem::path &source,
-                  const boost::filesystem::path &destination,
-                  const std::size_t beginBlock,
-                  const std::size_t endBlock)
+    void parallelSort(Data *const data,
+                      Data *const buffer,
+                      const std::size_t size,
+                      const std::size_t beginBlock,
+                      const std::size_t endBlock,
+                      const std::size_t threads) noexcept
     {
-        if (source == destination)
+        typedef Digits<blockBitSize> D;
+        BOOST_ASSERT(beginBlock <= endBlock && endBlock <= iterations);
+        const std::size_t chunks = std::min(threads, size / minParallelPartSize);
+        if (chunks <= 1 || beginBlock == endBlock)
         {
-            try
+            sort(data, buffer, size, beginBlock, endBlock);
+            return;
+        }
+        std::vector<std::size_t> histogram;
+        std::vector<Data *> chunkBuckets;
+        try
+        {
+            histogram.resize(chunks * D::buckets);
+            chunkBuckets.resize(chunks * D::buckets);
+        }
+        catch (std::bad_alloc &)
+        {
+            sort(data, buffer, size, beginBlock, endBlock);
+            return;
+        }
+        const std::size_t msdBlock = endBlock - 1;
+        const std::size_t chunkSize = (size + chunks - 1) / chunks;
+        const auto chunkBegin = [&](const std::size_t chunk) { return std::min(chunk * chunkSize, size); };
+
+        // histogram of the highest block by chunks
+        std::atomic<std::size_t> next(0);
+        runThreads(chunks,
+            [&]()
             {
-                FileMemoryMap map(source, O_RDWR);
-                if (map.fileSize() % sizeof(Data) != 0)
-                    BOOST_THROW_EXCEPTION(InvalidFileSizeError());
-                map.mapFull(PROT_READ, MAP_PRIVATE);
-                std::vector<Data> data = io::readFromMap(map.map());
-                map.unmap();
-                if (!sort(data, beginBlock, endBlock))
-                    throw std::bad_alloc();
-                map.mapFull(PROT_READ | PROT_WRITE, MAP_SHARED);
-                io::writeToMap(map.map(), data);
-            }
-            catch (InvalidFileSizeError &e)
+                for (std::size_t chunk; (chunk = next++) < chunks;)
+                {
+                    std::size_t *const chunkHistogram = histogram.data() + chunk * D::buckets;
+                    for (std::size_t i = chunkBegin(chunk); i < chunkBegin(chunk + 1); ++i)
+                        ++chunkHistogram[D::digit(data[i], msdBlock)];
+                }
+            });
+
+        // bucket is written by chunks in order
+        std::vector<std::size_t> bucketBegin(D::buckets + 1);
+        for (std::size_t bucket = 0, allocated = 0; bucket < D::buckets; ++bucket)
+        {
+            bucketBegin[bucket] = allocated;
+            for (std::size_t chunk = 0; chunk < chunks; ++chunk)
             {
-                e << InvalidFileSizeError::path(source);
-                throw;
+                chunkBuckets[chunk * D::buckets + bucket] = buffer + allocated;
+                allocated += histogram[chunk * D::buckets + bucket];
             }
         }
-        else
+        bucketBegin[D::buckets] = size;
+
+        next = 0;
+        runThreads(chunks,
+            [&]()
+            {
+                for (std::size_t chunk; (chunk = next++) < chunks;)
+                {
+                    const std::size_t begin = chunkBegin(chunk), end = chunkBegin(chunk + 1);
+                    scatter<blockBitSize>(data + begin, end - begin, msdBlock,
+                                          chunkBuckets.data() + chunk * D::buckets,
+                                          isWriteCombining<blockBitSize>(Scatter::automatic, end - begin));
+                }
+            });
+
+        // buckets are independent
+        next = 0;
+        runThreads(chunks,
+            [&]()
+            {
+                for (std::size_t bucket; (bucket = next++) < D::buckets;)
+                {
+                    const std::size_t begin = bucketBegin[bucket], end = bucketBegin[bucket + 1];
+                    sortBucket<blockBitSize>(buffer + begin, data + begin, end - begin,
+                                             beginBlock, msdBlock);
+                }
+            });
+    }
+
+    bool parallelSort(std::vector<Data> &data,
+                      const std::size_t beginBlock,
+                      const std::size_t endBlock,
+                      const std::size_t threads) noexcept
+    {
+        try
+        {
+            std::vector<Data> buffer(data.size());
+            parallelSort(data, buffer, beginBlock, endBlock, threads);
+            return true;
+        }
+        catch (std::bad_alloc &)
+        {
+            return false;
+        }
+    }
+
+    void sortInPlace(Data *const data,
+                     const std::size_t size,
+                     const std::size_t beginBlock,
+                     const std::size_t endBlock,
+                     const std::size_t threads) noexcept
+    {
+        typedef Digits<blockBitSize> D;
+        BOOST_ASSERT(beginBlock <= endBlock && endBlock <= iterations);
+        if (beginBlock == endBlock)
+            return;
+        if (std::min(threads, size / minParallelPartSize) <= 1)
         {
-            std::vector<Data> data = io::readFromFile(source);
-            if (!sort(data, beginBlock, endBlock))
-                throw std::bad_alloc();
-            io::writeToFile(destination, data);
+            sortInPlaceBlocks(data, size, beginBlock, endBlock);
+            return;
         }
+        std::size_t bucketEnd[D::buckets];
+        const std::size_t msdBlock = endBlock - 1;
+        if (!permuteBlock(data, size, msdBlock, bucketEnd))
+        {
+            sortInPlace(data, size, beginBlock, msdBlock, threads);
+            return;
+        }
+        // buckets are independent
+        std::atomic<std::size_t> next(0);
+        runThreads(threads,
+            [&]()
+            {
+                for (std::size_t bucket; (bucket = next++) < D::buckets;)
+                {
+                    const std::size_t begin = bucket ? bucketEnd[bucket - 1] : 0;
+                    sortInPlaceBlocks(data + begin, bucketEnd[bucket] - begin, beginBlock, msdBlock);
+                }
+            });
+    }
+
+    RunDetector sortFile(const boost::filesystem::path &source,
+                         const boost::filesystem::path &destination,
+                         const std::size_t beginBlock,
+                         const std::size_t endBlock)
+    {
+        return sortFileBy(source, destination,
+            [&](Data *const data, const std::size_t size, const RunDetector &runs)
+            {
+                if (sortPresorted(data, size, runs, beginBlock, endBlock, true))
+                    return;
+                // destination mapping is one of radix buffers
+                RadixSorter sorter;
+                if (!sorter.sort(data, size, beginBlock, endBlock, parallelThreads()))
+                    sortInPlace(data, size, beginBlock, endBlock, parallelThreads());
+            });
+    }
+
+    RunDetector sortFileInPlace(const boost::filesystem::path &source,
+                                const boost::filesystem::path &destination,
+                                const std::size_t beginBlock,
+                                const std::size_t endBlock)
+    {
+        return sortFileBy(source, destination,
+            [&](Data *const data, const std::size_t size, const RunDetector &runs)
+            {
+                // merge buffer is not affordable
+                if (!sortPresorted(data, size, runs, beginBlock, endBlock, false))
+                    sortInPlace(data, size, beginBlock, endBlock, parallelThreads());
+            });
     }
 }}}}
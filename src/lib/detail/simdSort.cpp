@@ -0,0 +1,259 @@
+#include "yandex/intern/detail/simdSort.hpp"
+
+#include <boost/assert.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <new>
+
+#include <cstring>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#   define YANDEX_INTERN_SIMD_SORT_AVX2
+#   include <immintrin.h>
+#endif
+
+namespace yandex{namespace intern{namespace detail
+{
+    namespace
+    {
+        /// Elements sorted by network of registers.
+        constexpr std::size_t blockSize = 64;
+
+        /// Elements per register.
+        constexpr std::size_t vectorSize = 8;
+
+        /// Padding is too expensive for smaller sizes.
+        constexpr std::size_t minNetworkSortSize = 16;
+
+        std::size_t padded(const std::size_t size)
+        {
+            return (size + blockSize - 1) / blockSize * blockSize;
+        }
+
+#ifdef YANDEX_INTERN_SIMD_SORT_AVX2
+        const bool hasAvx2 = __builtin_cpu_supports("avx2");
+
+#   define YANDEX_INTERN_AVX2 __attribute__((target("avx2"), always_inline)) inline
+
+        YANDEX_INTERN_AVX2
+        void compareExchange(__m256i &a, __m256i &b)
+        {
+            const __m256i min = _mm256_min_epu32(a, b);
+            b = _mm256_max_epu32(a, b);
+            a = min;
+        }
+
+        /// Optimal network of 19 comparators sorts columns.
+        YANDEX_INTERN_AVX2
+        void sortColumns(__m256i *const r)
+        {
+            compareExchange(r[0], r[2]); compareExchange(r[1], r[3]);
+            compareExchange(r[4], r[6]); compareExchange(r[5], r[7]);
+            compareExchange(r[0], r[4]); compareExchange(r[1], r[5]);
+            compareExchange(r[2], r[6]); compareExchange(r[3], r[7]);
+            compareExchange(r[0], r[1]); compareExchange(r[2], r[3]);
+            compareExchange(r[4], r[5]); compareExchange(r[6], r[7]);
+            compareExchange(r[2], r[4]); compareExchange(r[3], r[5]);
+            compareExchange(r[1], r[4]); compareExchange(r[3], r[6]);
+            compareExchange(r[1], r[2]); compareExchange(r[3], r[4]); compareExchange(r[5], r[6]);
+        }
+
+        YANDEX_INTERN_AVX2
+        void transpose(__m256i *const r)
+        {
+            const __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]), t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+            const __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]), t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+            const __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]), t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+            const __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]), t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+            const __m256i u0 = _mm256_unpacklo_epi64(t0, t2), u1 = _mm256_unpackhi_epi64(t0, t2);
+            const __m256i u2 = _mm256_unpacklo_epi64(t1, t3), u3 = _mm256_unpackhi_epi64(t1, t3);
+            const __m256i u4 = _mm256_unpacklo_epi64(t4, t6), u5 = _mm256_unpackhi_epi64(t4, t6);
+            const __m256i u6 = _mm256_unpacklo_epi64(t5, t7), u7 = _mm256_unpackhi_epi64(t5, t7);
+            r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+            r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+            r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+            r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+            r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+            r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+            r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+            r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+        }
+
+        /// Sort bitonic sequence.
+        YANDEX_INTERN_AVX2
+        __m256i bitonicSort(__m256i x)
+        {
+            __m256i y = _mm256_permute2x128_si256(x, x, 0x01);
+            x = _mm256_blend_epi32(_mm256_min_epu32(x, y), _mm256_max_epu32(x, y), 0xF0);
+            y = _mm256_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2));
+            x = _mm256_blend_epi32(_mm256_min_epu32(x, y), _mm256_max_epu32(x, y), 0xCC);
+            y = _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1));
+            return _mm256_blend_epi32(_mm256_min_epu32(x, y), _mm256_max_epu32(x, y), 0xAA);
+        }
+
+        /// Merge sorted a and b, lower half is stored to a, upper to b.
+        YANDEX_INTERN_AVX2
+        void bitonicMerge(__m256i &a, __m256i &b)
+        {
+            const __m256i reversed = _mm256_permutevar8x32_epi32(b, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+            const __m256i min = _mm256_min_epu32(a, reversed);
+            const __m256i max = _mm256_max_epu32(a, reversed);
+            a = bitonicSort(min);
+            b = bitonicSort(max);
+        }
+
+        YANDEX_INTERN_AVX2
+        __m256i load(const Data *const data)
+        {
+            return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+        }
+
+        YANDEX_INTERN_AVX2
+        void store(Data *const data, const __m256i x)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(data), x);
+        }
+
+        /// Blocks of 64 elements are transformed to sorted runs of 8.
+        __attribute__((target("avx2")))
+        void sortRuns(Data *const data, const std::size_t size)
+        {
+            for (std::size_t block = 0; block < size; block += blockSize)
+            {
+                __m256i r[vectorSize];
+                for (std::size_t i = 0; i < vectorSize; ++i)
+                    r[i] = load(data + block + i * vectorSize);
+                sortColumns(r);
+                transpose(r);
+                for (std::size_t i = 0; i < vectorSize; ++i)
+                    store(data + block + i * vectorSize, r[i]);
+            }
+        }
+
+        /// Merge sorted a and b, sizes are multiples of 8.
+        __attribute__((target("avx2")))
+        void mergeRuns(const Data *a, const Data *const aEnd,
+                       const Data *b, const Data *const bEnd,
+                       Data *dst)
+        {
+            __m256i lo = load(a), hi = load(b);
+            a += vectorSize;
+            b += vectorSize;
+            bitonicMerge(lo, hi);
+            store(dst, lo);
+            dst += vectorSize;
+            while (a < aEnd || b < bEnd)
+            {
+                // next 8 elements are the smallest remaining ones
+                if (b == bEnd || (a < aEnd && *a < *b))
+                {
+                    lo = load(a);
+                    a += vectorSize;
+                }
+                else
+                {
+                    lo = load(b);
+                    b += vectorSize;
+                }
+                bitonicMerge(lo, hi);
+                store(dst, lo);
+                dst += vectorSize;
+            }
+            store(dst, hi);
+        }
+
+        /*!
+         * \brief Sort data using buffer of the same size.
+         *
+         * \param size multiple of blockSize
+         */
+        __attribute__((target("avx2")))
+        void networkSort(Data *const data, Data *const buffer, const std::size_t size)
+        {
+            BOOST_ASSERT(size % blockSize == 0);
+            sortRuns(data, size);
+            Data *from = data, *to = buffer;
+            for (std::size_t run = vectorSize; run < size; run *= 2)
+            {
+                for (std::size_t begin = 0; begin < size; begin += 2 * run)
+                {
+                    const std::size_t middle = std::min(begin + run, size);
+                    const std::size_t end = std::min(begin + 2 * run, size);
+                    if (middle == end)
+                        memcpy(to + begin, from + begin, (end - begin) * sizeof(Data));
+                    else
+                        mergeRuns(from + begin, from + middle, from + middle, from + end, to + begin);
+                }
+                std::swap(from, to);
+            }
+            if (from != data)
+                memcpy(data, from, size * sizeof(Data));
+        }
+
+#   undef YANDEX_INTERN_AVX2
+#endif
+
+        /*!
+         * \brief Sort size elements of data, buffer has padded(size) elements.
+         *
+         * \param data has padded(size) elements
+         */
+        void sortPadded(Data *const data, Data *const buffer, const std::size_t size) noexcept
+        {
+#ifdef YANDEX_INTERN_SIMD_SORT_AVX2
+            if (hasAvx2 && size > minNetworkSortSize)
+            {
+                // maximum values remain after data
+                std::fill(data + size, data + padded(size), std::numeric_limits<Data>::max());
+                networkSort(data, buffer, padded(size));
+                return;
+            }
+#endif
+            std::sort(data, data + size);
+        }
+    }
+
+    bool simdSort(const Data *__restrict__ const src,
+                  Data *__restrict__ const dst,
+                  const std::size_t size) noexcept
+    {
+        if (size <= maxSimdSortSmallSize)
+        {
+            memcpy(dst, src, size * sizeof(Data));
+            simdSortSmall(dst, size);
+            return true;
+        }
+        const std::size_t paddedSize = padded(size);
+        if (paddedSize == size)
+        {
+            std::unique_ptr<Data[]> buffer(new (std::nothrow) Data[size]);
+            if (!buffer)
+                return false;
+            memcpy(dst, src, size * sizeof(Data));
+            sortPadded(dst, buffer.get(), size);
+        }
+        else
+        {
+            std::unique_ptr<Data[]> buffer(new (std::nothrow) Data[2 * paddedSize]);
+            if (!buffer)
+                return false;
+            Data *const data = buffer.get() + paddedSize;
+            memcpy(data, src, size * sizeof(Data));
+            sortPadded(data, buffer.get(), size);
+            memcpy(dst, data, size * sizeof(Data));
+        }
+        return true;
+    }
+
+    void simdSortSmall(Data *const data, const std::size_t size) noexcept
+    {
+        BOOST_ASSERT(size <= maxSimdSortSmallSize);
+        static_assert(maxSimdSortSmallSize % blockSize == 0, "");
+        Data padded[maxSimdSortSmallSize], buffer[maxSimdSortSmallSize];
+        memcpy(padded, data, size * sizeof(Data));
+        sortPadded(padded, buffer, size);
+        memcpy(data, padded, size * sizeof(Data));
+    }
+}}}
@@ -2,28 +2,47 @@
 #include "yandex/intern/Error.hpp"
 #include "yandex/intern/types.hpp"
 #include "yandex/intern/detail/bit.hpp"
+#include "yandex/intern/detail/copyFile.hpp"
+#include "yandex/intern/detail/FileMemoryMap.hpp"
 #include "yandex/intern/detail/io.hpp"
+#include "yandex/intern/detail/MemoryBudget.hpp"
+#include "yandex/intern/detail/PrefixHistogram.hpp"
+#include "yandex/intern/detail/PrefixRouter.hpp"
 #include "yandex/intern/detail/radixSort.hpp"
 #include "yandex/intern/detail/SequencedReader.hpp"
 #include "yandex/intern/detail/SequencedWriter.hpp"
 #include "yandex/intern/detail/Timer.hpp"
 
+#include "yandex/contest/SystemError.hpp"
+#include "yandex/contest/system/unistd/Operations.hpp"
+
 #include "bunsan/logging/legacy.hpp"
 
 #include <boost/filesystem/operations.hpp>
+#include <boost/scope_exit.hpp>
 
-#include <limits>
+#include <algorithm>
+#include <exception>
 #include <memory>
-#include <unordered_map>
+#include <numeric>
+#include <random>
 
 #include <cstdint>
+#include <ctime>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#ifdef __SSE2__
+#   include <emmintrin.h>
+#endif
 
 namespace yandex{namespace intern{namespace sorters
 {
     namespace unistd = contest::system::unistd;
 
-    constexpr std::size_t memoryLimitBytes = 256 * 1024 * 1024;
-
     constexpr std::size_t prefixByteSize = sizeof(Data) - 1;
     constexpr std::size_t suffixByteSize = sizeof(Data) - prefixByteSize;
     constexpr std::size_t prefixBitSize = 8 * prefixByteSize;
@@ -32,17 +51,253 @@ namespace yandex{namespace intern{namespace sorters
     constexpr std::size_t suffixSize = std::size_t(1) << suffixBitSize;
     constexpr std::size_t suffixMask = suffixSize - 1;
 
-    constexpr std::size_t prefixTreeSize = prefixSize * 2;
+    constexpr std::size_t dataBitSize = 8 * sizeof(Data);
+
+    constexpr std::size_t coarseSize = detail::PrefixHistogram::coarseSize;
+    constexpr std::size_t refineSize = detail::PrefixHistogram::refineSize;
+    constexpr std::size_t refineBitSize = detail::PrefixHistogram::refineBitSize;
+    static_assert(detail::PrefixHistogram::fineBitSize == prefixBitSize, "");
+
+    /// Part with at most halfBitSize free bits is stored as HalfData suffixes and count sorted.
+    constexpr std::size_t halfBitSize = 8 * sizeof(HalfData);
+
+    /// Oversized part with more free bits is split into resplitSize parts.
+    constexpr std::size_t resplitBitSize = 8;
+    constexpr std::size_t resplitSize = std::size_t(1) << resplitBitSize;
+    constexpr std::size_t resplitMask = resplitSize - 1;
+    static_assert(resplitBitSize < halfBitSize, "");
+    /// Elements are staged by blocks per part of oversized part.
+    constexpr std::size_t resplitBlockSize = 1024;
+
+    constexpr std::size_t maxSplitThreads = 32;
+
+    constexpr std::size_t samplingBlockByteSize = 1024 * 1024;
+    constexpr std::size_t minSampleByteSize = 16 * samplingBlockByteSize;
+    /// 1 / samplingRatio of input is read by sampling
+    constexpr std::size_t samplingRatio = 64;
+
+    /// Elements are routed by batches before they are scattered.
+    constexpr std::size_t routeBatchSize = 1024;
+
+    constexpr std::size_t cacheLineByteSize = 64;
+    constexpr std::size_t lineSize = cacheLineByteSize / sizeof(Data);
+
+    /// Scattering directly into part buffers is faster for fewer parts.
+    constexpr std::size_t minWriteCombiningParts = 512;
+
+    constexpr std::size_t maxInputReaderBufferSize = 1024 * 1024;
+    constexpr std::size_t minPartWriterBufferSize = 1024;
+    constexpr std::size_t maxPartWriterBufferSize = 16 * 1024;
+
+    namespace
+    {
+        /// Prefix is stored with leading 1 bit.
+        std::size_t commonBitSize(std::size_t prefix)
+        {
+            BOOST_ASSERT(prefix);
+            std::size_t bitSize = 0;
+            for (; prefix > 1; prefix >>= 1)
+                ++bitSize;
+            BOOST_ASSERT(bitSize <= dataBitSize);
+            return bitSize;
+        }
+
+        bool isHalfPart(const std::size_t prefix)
+        {
+            return dataBitSize - commonBitSize(prefix) <= halfBitSize;
+        }
+
+        std::size_t partElementSize(const std::size_t prefix)
+        {
+            return isHalfPart(prefix) ? sizeof(HalfData) : sizeof(Data);
+        }
+
+        /// Read part by buffers of T and remove it.
+        template <typename T, typename Process>
+        void readPart(const boost::filesystem::path &part,
+                      const std::size_t bufferSize,
+                      std::atomic<std::size_t> &bytesRead,
+                      const Process &process)
+        {
+            detail::SequencedReader input(part);
+            std::vector<T> buffer(bufferSize);
+            std::size_t actuallyRead;
+            do
+            {
+                input.read(buffer.data(), buffer.size(), &actuallyRead);
+                BOOST_ASSERT(actuallyRead % sizeof(T) == 0);
+                process(buffer.data(), actuallyRead / sizeof(T));
+                bytesRead += actuallyRead;
+            }
+            while (actuallyRead == buffer.size() * sizeof(T));
+            input.close();
+            boost::filesystem::remove(part);
+        }
+
+        /*!
+         * \brief Merge sibling subtrees bottom-up while merged size is less than maxPartSize.
+         *
+         * \param tree subtree sizes, node i has children 2i and 2i+1, root is 1
+         * \param isEnd subtrees that are parts, only leaves may be set initially
+         */
+        void balancePrefixTree(std::vector<std::uint64_t> &tree, std::vector<bool> &isEnd, const std::size_t maxPartSize)
+        {
+            for (std::size_t i = tree.size() / 2 - 1; i > 0; --i)
+            {
+                const std::size_t left = 2 * i;
+                const std::size_t right = left + 1;
+                if (isEnd[left] && isEnd[right] && tree[left] + tree[right] < maxPartSize)
+                {
+                    isEnd[left] = false;
+                    isEnd[right] = false;
+                    tree[i] = tree[left] + tree[right];
+                    isEnd[i] = true;
+                }
+            }
+        }
+
+        /// Part and its radix buffer are in memory during merge().
+        std::size_t maxPartSize(const std::size_t memoryLimitBytes)
+        {
+            const std::size_t maxPartByteSize = memoryLimitBytes / 4 + memoryLimitBytes / 16;
+            return maxPartByteSize / sizeof(Data);
+        }
+
+        /*!
+         * \brief Coarse prefix is refined when it has 1/4 of maxPartSize elements.
+         *
+         * Elements counted before refinement are distributed proportionally.
+         *
+         * \param sampleRatio part of input that is counted
+         */
+        std::uint64_t refineThreshold(const std::size_t maxPartSize, const double sampleRatio)
+        {
+            const std::uint64_t threshold = static_cast<std::uint64_t>(maxPartSize / 4 * sampleRatio);
+            return std::max(threshold, std::uint64_t(1));
+        }
+
+        /// Refined prefixes use at most 1/16 of memory.
+        std::size_t maxRefined(const std::size_t memoryLimitBytes)
+        {
+            return std::max(memoryLimitBytes / 16 / detail::PrefixHistogram::refinedByteSize, std::size_t(1));
+        }
+
+        Data *alignLine(Data *const data)
+        {
+            const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(data);
+            const std::uintptr_t aligned = (address + cacheLineByteSize - 1) & ~std::uintptr_t(cacheLineByteSize - 1);
+            return reinterpret_cast<Data *>(aligned);
+        }
+
+        /*!
+         * \brief Copy cache line bypassing cache.
+         *
+         * \note dst should be 16 bytes aligned,
+         * streamFence() should be called before dst is used by another thread.
+         */
+        void streamLine(Data *const dst, const Data *const src)
+        {
+#ifdef __SSE2__
+            static_assert(cacheLineByteSize % sizeof(__m128i) == 0, "");
+            BOOST_ASSERT(reinterpret_cast<std::uintptr_t>(dst) % sizeof(__m128i) == 0);
+            __m128i *const to = reinterpret_cast<__m128i *>(dst);
+            const __m128i *const from = reinterpret_cast<const __m128i *>(src);
+            for (std::size_t i = 0; i < cacheLineByteSize / sizeof(__m128i); ++i)
+                _mm_stream_si128(to + i, _mm_load_si128(from + i));
+#else
+            std::copy(src, src + lineSize, dst);
+#endif
+        }
+
+        void streamFence()
+        {
+#ifdef __SSE2__
+            _mm_sfence();
+#endif
+        }
+
+        std::size_t splitThreads()
+        {
+            std::size_t threads = boost::thread::hardware_concurrency();
+            if (!threads)
+                threads = 1;
+            if (threads > maxSplitThreads)
+                threads = maxSplitThreads;
+            return threads;
+        }
+
+        /// Parts are sorted in memory, other merge buffers are small.
+        std::size_t mergeMemoryByteSize(const std::size_t memoryLimitBytes)
+        {
+            return memoryLimitBytes - memoryLimitBytes / 8;
+        }
+
+        /// Part is read while others are sorted.
+        std::size_t mergeThreads(const std::size_t threads)
+        {
+            return threads + 1;
+        }
+
+        /*!
+         * \brief Every counting thread holds local histogram.
+         *
+         * Counting precedes split, so histograms use memory of part buffers, 1/2 of memory.
+         */
+        std::size_t histogramThreads(const std::size_t memoryLimitBytes, const std::size_t threads)
+        {
+            const std::size_t maxThreads = memoryLimitBytes / 2 / detail::PrefixHistogram::coarseByteSize;
+            return std::max(std::min(threads, maxThreads), std::size_t(1));
+        }
+        static_assert(detail::PrefixHistogram::coarseByteSize <= Sorter::minMemoryLimitBytes / 2,
+                      "at least one histogram fits");
+
+        /// Input reader, storage and every split worker hold a buffer, 1/8 of memory is used.
+        std::size_t inputReaderBufferSize(const std::size_t memoryLimitBytes, const std::size_t threads)
+        {
+            const std::size_t size = memoryLimitBytes / 8 / (threads + 2) / sizeof(Data);
+            return std::min(size, maxInputReaderBufferSize);
+        }
+
+        /// Queue holds buffers of at most maxPartWriterBufferSize, 1/128 of memory is used.
+        std::size_t partOutputSize(const std::size_t memoryLimitBytes)
+        {
+            const std::size_t size = memoryLimitBytes / 128 / (maxPartWriterBufferSize * sizeof(Data));
+            return std::max(size, std::size_t(1));
+        }
 
-    constexpr std::size_t inputReaderBufferSize = 1024 * 1024;
-    constexpr std::size_t partWriterBufferSize = 16 * 1024;
+        /// Split workers whose buffers of at least minPartWriterBufferSize per part fit into 1/2 of memory.
+        std::size_t partWriterThreads(const std::size_t memoryLimitBytes,
+                                      const std::size_t threads,
+                                      const std::size_t parts)
+        {
+            const std::size_t maxThreads =
+                memoryLimitBytes / 2 / (std::max(parts, std::size_t(1)) * minPartWriterBufferSize * sizeof(Data));
+            return std::min(threads, maxThreads);
+        }
 
-    constexpr std::size_t maxPartByteSize = memoryLimitBytes / 4 + memoryLimitBytes / 16;
-    constexpr std::size_t maxPartSize = maxPartByteSize / sizeof(Data);
+        /// Every split worker holds a buffer per part, 1/2 of memory is used.
+        std::size_t partWriterBufferSize(const std::size_t memoryLimitBytes,
+                                         const std::size_t threads,
+                                         const std::size_t parts)
+        {
+            const std::size_t size = memoryLimitBytes / 2 / (threads * std::max(parts, std::size_t(1)) * sizeof(Data));
+            const std::size_t clamped = std::max(std::min(size, maxPartWriterBufferSize), minPartWriterBufferSize);
+            // whole cache lines are written
+            return clamped / lineSize * lineSize;
+        }
+    }
 
-    BalancedSplitSorter::BalancedSplitSorter(const boost::filesystem::path& src, const boost::filesystem::path& dst):
-        Sorter(src, dst),
-        partOutput_(32), // FIXME tricky constant
+    BalancedSplitSorter::BalancedSplitSorter(const boost::filesystem::path& src, const boost::filesystem::path& dst,
+                                             const std::size_t memoryLimitBytes,
+                                             const PrefixSplitMode prefixSplitMode):
+        Sorter(src, dst, memoryLimitBytes),
+        maxPartSize_(maxPartSize(memoryLimitBytes)),
+        splitThreads_(splitThreads()),
+        inputReaderBufferSize_(inputReaderBufferSize(memoryLimitBytes, splitThreads_)),
+        mergeMemory_(mergeMemoryByteSize(memoryLimitBytes)),
+        resplitDescriptors_(static_cast<std::size_t>(unistd::getdtablesize()) / 2),
+        prefixSplitMode_(prefixSplitMode),
+        partOutput_(partOutputSize(memoryLimitBytes)),
         root_(dst.parent_path() / boost::filesystem::unique_path())
     {
         BOOST_VERIFY(boost::filesystem::create_directory(root_)); // directory is new
@@ -53,19 +308,56 @@ namespace yandex{namespace intern{namespace sorters
         boost::filesystem::remove_all(root_);
     }
 
+    bool BalancedSplitSorter::isApplicable(const std::size_t inputByteSize, const std::size_t memoryLimitBytes)
+    {
+        // merged parts are at least half of maxPartSize()
+        const std::size_t parts = 2 * inputByteSize / (maxPartSize(memoryLimitBytes) * sizeof(Data)) + 1;
+        const std::size_t descriptors = static_cast<std::size_t>(unistd::getdtablesize()) / 2;
+        return parts <= descriptors && partWriterThreads(memoryLimitBytes, 1, parts);
+    }
+
+    std::size_t BalancedSplitSorter::spaceRequired(const std::size_t inputByteSize, const bool inPlace)
+    {
+        // destination is allocated before parts are removed
+        return inPlace ? inputByteSize : 2 * inputByteSize;
+    }
+
+    std::size_t BalancedSplitSorter::bytesRead() const
+    {
+        return bytesRead_.load();
+    }
+
     void BalancedSplitSorter::sort()
     {
         try
         {
+            switch (prefixSplitMode_)
+            {
+            case PrefixSplitMode::automatic:
+                // sampling saves a pass over input if sample is small enough
+                prefixSampling_ = boost::filesystem::file_size(source()) / samplingRatio >= minSampleByteSize;
+                break;
+            case PrefixSplitMode::histogram:
+                prefixSampling_ = false;
+                break;
+            case PrefixSplitMode::sampling:
+                prefixSampling_ = true;
+                break;
+            }
             inputReader_ = boost::thread(boost::bind(&BalancedSplitSorter::inputReader, this));
             detail::Timer timer("prefix balance phase");
             buildPrefixSplit();
+            timer.stop();
+            if (copyPresorted())
+                return;
             timer.start("split phase");
             split();
             inputReader_.join();
             timer.start("merge phase");
             merge();
-            SLOG("Completed.");
+            timer.stop();
+            SLOG("Completed, " << bytesRead_.load() << " bytes were read (" <<
+                 static_cast<double>(bytesRead_) / std::max(inputByteSize_, std::size_t(1)) << " of input size).");
         }
         catch (...)
         {
@@ -82,73 +374,220 @@ namespace yandex{namespace intern{namespace sorters
     void BalancedSplitSorter::buildPrefixSplit()
     {
         SLOG("Building prefix mapping.");
-        typedef std::uint32_t SizeType;
-        std::vector<SizeType> prefixTree(prefixTreeSize);
+        std::vector<PrefixEnd> ends;
         {
-            std::vector<Data> buffer;
-            while (inputForBuildPrefixSplit_.pop(buffer))
+            const detail::PrefixHistogram histogram = prefixSampling_ ? samplePrefixes() : countPrefixes();
+            SLOG("Balancing prefix mapping, " << histogram.refinedNumber() << " prefixes were refined.");
+            std::vector<std::uint64_t> coarseTree(2 * coarseSize);
+            std::vector<bool> coarseIsEnd(2 * coarseSize);
+            std::vector<std::uint64_t> fineTree(2 * refineSize);
+            std::vector<bool> fineIsEnd(2 * refineSize);
+            for (std::size_t coarse = 0; coarse < coarseSize; ++coarse)
             {
-                for (const Data data: buffer)
+                coarseTree[coarseSize | coarse] = histogram.coarse(coarse);
+                coarseIsEnd[coarseSize | coarse] = true;
+                if (histogram.isRefined(coarse))
                 {
-                    const std::size_t key = data >> suffixBitSize;
-                    const std::size_t prefix = key | prefixSize;
-                    if (prefixTree[prefix] < std::numeric_limits<SizeType>::max())
-                        ++prefixTree[prefix];
+                    std::fill(fineIsEnd.begin(), fineIsEnd.end(), false);
+                    for (std::size_t refine = 0; refine < refineSize; ++refine)
+                    {
+                        fineTree[refineSize | refine] = histogram.fine(coarse, refine);
+                        fineIsEnd[refineSize | refine] = true;
+                    }
+                    balancePrefixTree(fineTree, fineIsEnd, maxPartSize_);
+                    if (!fineIsEnd[1])
+                    {
+                        // refined prefix is split and can't be merged with siblings
+                        coarseIsEnd[coarseSize | coarse] = false;
+                        for (std::size_t depth = 1; depth <= refineBitSize; ++depth)
+                        {
+                            const std::size_t level = std::size_t(1) << depth;
+                            for (std::size_t node = level; node < 2 * level; ++node)
+                                if (fineIsEnd[node])
+                                    ends.push_back({((coarseSize | coarse) << depth) | (node ^ level), fineTree[node]});
+                        }
+                    }
                 }
             }
+            balancePrefixTree(coarseTree, coarseIsEnd, maxPartSize_);
+            for (std::size_t node = 1; node < coarseTree.size(); ++node)
+                if (coarseIsEnd[node])
+                    ends.push_back({node, coarseTree[node]});
         }
-        SLOG("Balancing prefix mapping.");
-        isEnd_.resize(prefixTreeSize);
-        for (std::size_t i = prefixTreeSize - 1; i >= prefixSize; --i)
-            isEnd_[i] = true;
-        for (std::size_t i = prefixSize - 1; i < prefixTreeSize; --i)
-        {
-            const std::size_t left = 2 * i;
-            const std::size_t right = left + 1;
-            const std::size_t leftSize = prefixTree[left];
-            const std::size_t rightSize = prefixTree[right];
-            if (leftSize < std::numeric_limits<SizeType>::max() &&
-                rightSize < std::numeric_limits<SizeType>::max() &&
-                isEnd_[left] && isEnd_[right] &&
-                leftSize + rightSize < maxPartSize)
+        buildCompressedPrefixSplit(ends);
+    }
+
+    bool BalancedSplitSorter::copyPresorted()
+    {
+        // runs are not detected by sampling
+        if (prefixSampling_)
+            return false;
+        SLOG("Input is " << inputRuns_ << ".");
+        if (!inputRuns_.isSorted() && !inputRuns_.isReversed())
+            return false;
+        // inputReader() skips the second pass
+        inputReader_.join();
+        const bool inPlace = boost::filesystem::exists(destination()) &&
+                             boost::filesystem::equivalent(source(), destination());
+        detail::Timer timer("copy phase");
+        if (inputRuns_.isSorted())
+        {
+            if (!inPlace)
+                detail::copyFile(source(), destination());
+        }
+        else if (inPlace)
+        {
+            // page cache is used instead of memory
+            detail::FileMemoryMap map(source(), O_RDWR);
+            if (map.fileSize())
             {
-                isEnd_[left] = false;
-                isEnd_[right] = false;
-                prefixTree[i] = leftSize + rightSize;
-                isEnd_[i] = true;
+                map.mapFull(PROT_READ | PROT_WRITE, MAP_SHARED);
+                Data *const data = static_cast<Data *>(map.data());
+                std::reverse(data, data + map.fileSize() / sizeof(Data));
+                map.unmap();
             }
+            map.close();
         }
-        buildCompressedPrefixSplit();
-        // save size
-        id2size_.resize(id2prefix_.size());
-        for (std::size_t id = 0; id < id2prefix_.size(); ++id)
+        else
+        {
+            detail::SequencedReader input(source());
+            detail::SequencedWriter output(destination());
+            const std::size_t size = inputRuns_.size();
+            output.resize(size * sizeof(Data));
+            std::vector<Data> data(inputReaderBufferSize_);
+            for (std::size_t begin = 0; begin < size; begin += data.size())
+            {
+                data.resize(std::min(data.size(), size - begin));
+                BOOST_VERIFY(input.read(data.data(), data.size()));
+                std::reverse(data.begin(), data.end());
+                output.seek((size - begin - data.size()) * sizeof(Data));
+                output.write(data.data(), data.size());
+            }
+            output.close();
+            input.close();
+        }
+        timer.stop();
+        return true;
+    }
+
+    detail::PrefixHistogram BalancedSplitSorter::countPrefixes()
+    {
+        const std::size_t threads = histogramThreads(memoryLimitBytes(), splitThreads_);
+        SLOG("Counting prefixes using " << threads << " threads.");
+        // refined prefixes of all local histograms fit into maxRefined() after merge
+        const detail::PrefixHistogram empty(
+            refineThreshold(maxPartSize_, 1.0 / threads),
+            std::max(maxRefined(memoryLimitBytes()) / threads, std::size_t(1)));
+        std::vector<detail::PrefixHistogram> histograms(threads, empty);
+        boost::mutex errorLock;
+        std::exception_ptr error;
+        boost::thread_group counters;
+        for (detail::PrefixHistogram &histogram: histograms)
+        {
+            counters.create_thread(
+                [&]()
+                {
+                    try
+                    {
+                        std::vector<Data> buffer;
+                        while (inputForBuildPrefixSplit_.pop(buffer))
+                            histogram.add(buffer.data(), buffer.size());
+                    }
+                    catch (...)
+                    {
+                        {
+                            const boost::lock_guard<boost::mutex> lk(errorLock);
+                            if (!error)
+                                error = std::current_exception();
+                        }
+                        inputForBuildPrefixSplit_.closeError();
+                    }
+                });
+        }
+        counters.join_all();
+        if (error)
+            std::rethrow_exception(error);
+        for (std::size_t i = 1; i < histograms.size(); ++i)
+            histograms[0].merge(histograms[i]);
+        histograms[0].finalize();
+        return std::move(histograms[0]);
+    }
+
+    detail::PrefixHistogram BalancedSplitSorter::samplePrefixes()
+    {
+        const unistd::Descriptor fd = unistd::open(source(), O_RDONLY);
+        const std::size_t inputByteSize = unistd::fstat(fd.get()).size;
+        if (inputByteSize % sizeof(Data) != 0)
+            BOOST_THROW_EXCEPTION(InvalidFileSizeError() << InvalidFileSizeError::path(source()));
+
+        const std::size_t blocks = (inputByteSize + samplingBlockByteSize - 1) / samplingBlockByteSize;
+        const std::size_t sampleBlocks = std::min(blocks, std::max(
+            blocks / samplingRatio, minSampleByteSize / samplingBlockByteSize));
+        SLOG("Sampling " << sampleBlocks << " of " << blocks << " blocks.");
+
+        // random subset of blocks in ascending order, see Knuth's algorithm S
+        std::vector<std::size_t> sample;
+        sample.reserve(sampleBlocks);
+        std::mt19937 rng(std::time(nullptr));
+        for (std::size_t block = 0; block < blocks && sample.size() < sampleBlocks; ++block)
         {
-            if (prefixTree[id2prefix_[id]] == std::numeric_limits<SizeType>::max())
-                id2size_[id] = std::numeric_limits<std::size_t>::max();
-            else
-                id2size_[id] = prefixTree[id2prefix_[id]];
+            std::uniform_int_distribution<std::size_t> rnd(0, blocks - block - 1);
+            if (rnd(rng) < sampleBlocks - sample.size())
+                sample.push_back(block);
         }
+
+        detail::PrefixHistogram histogram(
+            refineThreshold(maxPartSize_, static_cast<double>(sampleBlocks) / std::max(blocks, std::size_t(1))),
+            maxRefined(memoryLimitBytes()));
+        std::vector<Data> buffer(samplingBlockByteSize / sizeof(Data));
+        std::size_t sampleSize = 0;
+        for (const std::size_t block: sample)
+        {
+            const std::size_t offset = block * samplingBlockByteSize;
+            const std::size_t size = std::min(samplingBlockByteSize, inputByteSize - offset);
+            char *const data = reinterpret_cast<char *>(buffer.data());
+            for (std::size_t read = 0; read < size;)
+            {
+                const ssize_t lastRead = ::pread(fd.get(), data + read, size - read, offset + read);
+                if (lastRead < 0)
+                    BOOST_THROW_EXCEPTION(contest::SystemError("pread") << unistd::info::fd(fd.get()));
+                if (lastRead == 0)
+                    BOOST_THROW_EXCEPTION(InvalidFileSizeError() << InvalidFileSizeError::path(source()));
+                read += lastRead;
+            }
+            bytesRead_ += size;
+            histogram.add(buffer.data(), size / sizeof(Data));
+            sampleSize += size / sizeof(Data);
+        }
+
+        // scale to input size
+        histogram.finalize(static_cast<double>(inputByteSize / sizeof(Data)) / std::max(sampleSize, std::size_t(1)));
+        return histogram;
     }
 
-    void BalancedSplitSorter::buildCompressedPrefixSplit()
+    void BalancedSplitSorter::buildCompressedPrefixSplit(std::vector<PrefixEnd> &ends)
     {
         SLOG("Compressing prefix mapping.");
-        std::vector<std::size_t> prefixes;
-        for (std::size_t i = 0; i < prefixTreeSize; ++i)
-            if (isEnd_[i])
-                prefixes.push_back(i);
-        std::sort(prefixes.begin(), prefixes.end(), detail::bit::lexicalLess);
-        id2prefix_.resize(prefixes.size());
-        isCountSorted_.resize(prefixes.size());
-        countSort_.resize(prefixes.size());
-        id2part_.resize(prefixes.size());
-        for (std::size_t id = 0; id < prefixes.size(); ++id)
-        {
-            const std::size_t prefix = prefixes[id];
+        std::sort(ends.begin(), ends.end(),
+            [](const PrefixEnd &a, const PrefixEnd &b)
+            {
+                return detail::bit::lexicalLess(a.prefix, b.prefix);
+            });
+        id2prefix_.resize(ends.size());
+        id2size_.resize(ends.size());
+        isCountSorted_.resize(ends.size());
+        countSort_.resize(ends.size());
+        id2part_.resize(ends.size());
+        for (std::size_t id = 0; id < ends.size(); ++id)
+        {
+            const std::size_t prefix = ends[id].prefix;
             id2prefix_[id] = prefix;
-            prefix2id_[prefix] = id;
+            id2size_[id] = ends[id].size;
             isCountSorted_[id] = prefix >= prefixSize;
         }
+        prefixRouter_ = detail::PrefixRouter(id2prefix_);
+        SLOG("Prefix mapping has " << id2prefix_.size() << " parts, " <<
+             prefixRouter_.refinedNumber() << " coarse prefixes are refined.");
     }
 
     void BalancedSplitSorter::split()
@@ -156,20 +595,30 @@ namespace yandex{namespace intern{namespace sorters
         try
         {
             SLOG("Splitting source file.");
+            std::size_t parts = 0;
             for (std::size_t id = 0; id < id2prefix_.size(); ++id)
             {
                 if (isCountSorted_[id])
+                {
                     countSort_[id].resize(suffixSize);
+                }
                 else
+                {
                     id2part_[id] = root_ / boost::filesystem::unique_path();
+                    ++parts;
+                }
             }
+            // fewer workers are used instead of smaller buffers
+            const std::size_t threads = partWriterThreads(memoryLimitBytes(), splitThreads_, parts);
+            if (!threads)
+                BOOST_THROW_EXCEPTION(MemoryLimitExceededError() <<
+                                      MemoryLimitExceededError::memoryLimit(memoryLimitBytes()) <<
+                                      MemoryLimitExceededError::memoryRequired(
+                                          2 * parts * minPartWriterBufferSize * sizeof(Data)));
+            partWriterBufferSize_ = partWriterBufferSize(memoryLimitBytes(), threads, parts);
+            SLOG("Splitting into " << parts << " parts using " << threads << " threads.");
             std::exception_ptr error;
             partWriter_ = boost::thread(boost::bind(&BalancedSplitSorter::partWriter, this, boost::ref(error)));
-            std::size_t threads = boost::thread::hardware_concurrency();
-            if (!threads)
-                threads = 1;
-            if (threads > 32)
-                threads = 32;
             for (std::size_t i = 0; i < threads; ++i)
                 splitWorkers_.create_thread(boost::bind(&BalancedSplitSorter::splitWorker, this));
             splitWorkers_.join_all();
@@ -211,18 +660,31 @@ namespace yandex{namespace intern{namespace sorters
                 else
                 {
                     partBuffer[id].id = id;
-                    partBuffer[id].data.resize(partWriterBufferSize);
+                    partBuffer[id].data.resize(partWriterBufferSize_);
                 }
             }
+            // for many parts small buffers are cache resident, part buffers are written by whole cache lines
+            const bool writeCombining = id2prefix_.size() >= minWriteCombiningParts;
+            std::vector<Data> lineStorage(writeCombining ? (id2prefix_.size() + 1) * lineSize : 0);
+            Data *const lines = alignLine(lineStorage.data());
+            std::vector<std::uint8_t> linePos(id2prefix_.size());
             const auto flush =
                 [&](const std::size_t id)
                 {
+                    if (linePos[id])
+                    {
+                        std::copy(lines + id * lineSize, lines + id * lineSize + linePos[id],
+                                  partBuffer[id].data.begin() + partPos[id]);
+                        partPos[id] += linePos[id];
+                        linePos[id] = 0;
+                    }
                     if (partPos[id])
                     {
+                        streamFence();
                         partBuffer[id].data.resize(partPos[id]);
                         partOutput_.push(std::move(partBuffer[id]));
                         partBuffer[id].id = id;
-                        partBuffer[id].data.resize(partWriterBufferSize);
+                        partBuffer[id].data.resize(partWriterBufferSize_);
                         partPos[id] = 0;
                     }
                 };
@@ -230,25 +692,53 @@ namespace yandex{namespace intern{namespace sorters
                 [&](const std::size_t id, const Data data)
                 {
                     partBuffer[id].data[partPos[id]++] = data;
-                    if (partPos[id] == partWriterBufferSize)
+                    if (partPos[id] == partWriterBufferSize_)
                         flush(id);
                 };
+            const auto pushLine =
+                [&](const std::size_t id, const Data data)
+                {
+                    Data *const line = lines + id * lineSize;
+                    line[linePos[id]++] = data;
+                    if (linePos[id] == lineSize)
+                    {
+                        streamLine(partBuffer[id].data.data() + partPos[id], line);
+                        linePos[id] = 0;
+                        partPos[id] += lineSize;
+                        if (partPos[id] == partWriterBufferSize_)
+                            flush(id);
+                    }
+                };
+            std::vector<std::uint32_t> ids(routeBatchSize);
             std::vector<Data> buffer;
             while (inputForSplit_.pop(buffer))
             {
-                for (const Data data: buffer)
+                for (std::size_t begin = 0; begin < buffer.size(); begin += routeBatchSize)
                 {
-                    std::size_t prefix = prefixSize + (data >> suffixBitSize);
-                    while (!isEnd_[prefix])
-                        prefix >>= 1;
-                    const std::size_t id = prefix2id_.at(prefix);
-                    if (isCountSorted_[id])
+                    const std::size_t size = std::min(routeBatchSize, buffer.size() - begin);
+                    const Data *const batch = buffer.data() + begin;
+                    prefixRouter_(batch, size, ids.data());
+                    if (writeCombining)
                     {
-                        ++countSort[id][data & suffixMask];
+                        for (std::size_t i = 0; i < size; ++i)
+                        {
+                            const std::size_t id = ids[i];
+                            if (isCountSorted_[id])
+                                ++countSort[id][batch[i] & suffixMask];
+                            else
+                                pushLine(id, batch[i]);
+                        }
                     }
                     else
                     {
-                        push(id, data);
+                        for (std::size_t i = 0; i < size; ++i)
+                        {
+                            const std::size_t id = ids[i];
+                            if (isCountSorted_[id])
+                                ++countSort[id][batch[i] & suffixMask];
+                            else
+                                push(id, batch[i]);
+                        }
                     }
                 }
             }
@@ -275,28 +765,235 @@ namespace yandex{namespace intern{namespace sorters
     void BalancedSplitSorter::merge()
     {
         SLOG("Merging temporary files.");
-        detail::SequencedWriter output(destination());
-        output.resize(inputByteSize_);
+        {
+            detail::SequencedWriter output(destination());
+            output.resize(inputByteSize_);
+            output.close();
+        }
+        // parts are written at known offsets in any order
+        std::vector<std::size_t> id2offset(id2prefix_.size());
+        std::size_t offset = 0;
         for (std::size_t id = 0; id < id2prefix_.size(); ++id)
         {
-            SLOG("Processing id = " << id + 1 << " / " << id2prefix_.size() <<
-                 " (" << (isCountSorted_[id] ? "count" : "radix") << ") size = " << id2size_[id] << ".");
-            if (isCountSorted_[id])
+            id2offset[id] = offset;
+            offset += id2size_[id];
+        }
+        BOOST_ASSERT(offset * sizeof(Data) == inputByteSize_);
+
+        const std::size_t threads = mergeThreads(splitThreads_);
+        SLOG("Merging using " << threads << " threads.");
+        boost::mutex lock;
+        std::size_t next = 0;
+        std::exception_ptr error;
+        boost::thread_group workers;
+        for (std::size_t i = 0; i < threads; ++i)
+        {
+            workers.create_thread(
+                [&]()
+                {
+                    try
+                    {
+                        PartSorter sorter(mergeMemory_);
+                        detail::SequencedWriter output(destination(), 0);
+                        for (;;)
+                        {
+                            std::size_t id;
+                            {
+                                const boost::lock_guard<boost::mutex> lk(lock);
+                                if (error || next == id2prefix_.size())
+                                    break;
+                                id = next++;
+                            }
+                            const char *const method = isCountSorted_[id] ? "count" :
+                                                       isHalfPart(id2prefix_[id]) ? "suffix count" : "radix";
+                            SLOG("Processing id = " << id + 1 << " / " << id2prefix_.size() <<
+                                 " (" << method << ") size = " << id2size_[id] << ".");
+                            output.seek(id2offset[id] * sizeof(Data));
+                            if (isCountSorted_[id])
+                            {
+                                BOOST_ASSERT(countSort_[id].size() == suffixSize);
+                                const Data prefix = id2prefix_[id] << suffixBitSize;
+                                for (Data suffix = 0; suffix < suffixSize; ++suffix)
+                                    for (std::size_t i = 0; i < countSort_[id][suffix]; ++i)
+                                        output.write(prefix | suffix);
+                            }
+                            else
+                            {
+                                mergePart(id2part_[id], id2size_[id], id2prefix_[id], output, sorter);
+                            }
+                        }
+                        // last parts are sorted using this thread
+                        ++mergeIdleThreads_;
+                        output.close();
+                    }
+                    catch (...)
+                    {
+                        const boost::lock_guard<boost::mutex> lk(lock);
+                        if (!error)
+                            error = std::current_exception();
+                    }
+                });
+        }
+        workers.join_all();
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    BalancedSplitSorter::PartSorter::PartSorter(detail::MemoryBudget &budget): budget_(budget) {}
+
+    BalancedSplitSorter::PartSorter::~PartSorter()
+    {
+        releaseScratch();
+    }
+
+    void BalancedSplitSorter::PartSorter::acquire(const std::size_t size)
+    {
+        const std::size_t byteSize = size * sizeof(Data);
+        const std::size_t scratchGrowth = byteSize - std::min(byteSize, scratchByteSize_);
+        if (!budget_.tryAcquire(byteSize + scratchGrowth))
+        {
+            // nothing is held while waiting, so workers do not block each other
+            releaseScratch();
+            budget_.acquire(2 * byteSize);
+        }
+        scratchByteSize_ = std::max(scratchByteSize_, byteSize);
+    }
+
+    void BalancedSplitSorter::PartSorter::release(const std::size_t size)
+    {
+        budget_.release(size * sizeof(Data));
+    }
+
+    void BalancedSplitSorter::PartSorter::acquireBuffer(const std::size_t byteSize)
+    {
+        if (!budget_.tryAcquire(byteSize))
+        {
+            releaseScratch();
+            budget_.acquire(byteSize);
+        }
+    }
+
+    void BalancedSplitSorter::PartSorter::releaseBuffer(const std::size_t byteSize)
+    {
+        budget_.release(byteSize);
+    }
+
+    void BalancedSplitSorter::PartSorter::sort(std::vector<Data> &data,
+                                               const std::size_t endBlock,
+                                               const std::size_t threads)
+    {
+        if (!sorter_.sort(data, 0, endBlock, threads))
+            throw std::bad_alloc();
+    }
+
+    void BalancedSplitSorter::PartSorter::releaseScratch()
+    {
+        sorter_.release();
+        budget_.release(scratchByteSize_);
+        scratchByteSize_ = 0;
+    }
+
+    void BalancedSplitSorter::mergePart(const boost::filesystem::path &part,
+                                        const std::size_t size,
+                                        const std::size_t prefix,
+                                        detail::SequencedWriter &output,
+                                        PartSorter &sorter)
+    {
+        const std::size_t freeBitSize = dataBitSize - commonBitSize(prefix);
+        if (isHalfPart(prefix))
+        {
+            const Data freeMask = (Data(1) << freeBitSize) - 1;
+            const Data common = static_cast<Data>(prefix << freeBitSize);
+            std::vector<std::size_t> count(std::size_t(freeMask) + 1);
+            readPart<HalfData>(part, inputReaderBufferSize_, bytesRead_,
+                [&](const HalfData *const data, const std::size_t size_)
+                {
+                    for (std::size_t i = 0; i < size_; ++i)
+                        ++count[data[i] & freeMask];
+                });
+            for (std::size_t suffix = 0; suffix < count.size(); ++suffix)
+                for (std::size_t i = 0; i < count[suffix]; ++i)
+                    output.write(static_cast<Data>(common | suffix));
+        }
+        else if (size <= maxPartSize_)
+        {
+            sorter.acquire(size);
+            BOOST_SCOPE_EXIT_ALL(&)
             {
-                BOOST_ASSERT(countSort_[id].size() == suffixSize);
-                const Data prefix = id2prefix_[id] << suffixBitSize;
-                for (Data suffix = 0; suffix < suffixSize; ++suffix)
-                    for (std::size_t i = 0; i < countSort_[id][suffix]; ++i)
-                        output.write(prefix | suffix);
-            }
-            else
+                sorter.release(size);
+            };
+            std::vector<Data> data = detail::io::readFromFile(part);
+            boost::filesystem::remove(part);
+            bytesRead_ += data.size() * sizeof(Data);
+            // common prefix blocks are equal for all elements
+            const std::size_t endBlock = (freeBitSize + detail::radix::blockBitSize - 1) / detail::radix::blockBitSize;
+            sorter.sort(data, endBlock, 1 + mergeIdleThreads_.load());
+            output.write(data.data(), data.size());
+        }
+        else
+        {
+            SLOG("Splitting oversized part of size = " << size << " with " << freeBitSize << " free bits.");
+            const std::size_t shift = freeBitSize - resplitBitSize;
+            std::vector<boost::filesystem::path> subParts(resplitSize);
+            std::vector<std::size_t> subSize(resplitSize);
             {
-                std::vector<Data> data = detail::io::readFromFile(id2part_[id]);
-                detail::radix::sort(data); // FIXME ML
-                output.write(data.data(), data.size());
+                const bool half = isHalfPart(prefix << resplitBitSize);
+                // memory is acquired before descriptors, so holder of descriptors does not wait
+                const std::size_t blocksByteSize = resplitSize * resplitBlockSize * sizeof(Data) +
+                                                   (half ? resplitBlockSize * sizeof(HalfData) : 0);
+                sorter.acquireBuffer(blocksByteSize);
+                BOOST_SCOPE_EXIT_ALL(&)
+                {
+                    sorter.releaseBuffer(blocksByteSize);
+                };
+                // sub-parts and part are opened
+                const detail::MemoryBudget::Guard descriptors(resplitDescriptors_, resplitSize + 1);
+                std::vector<std::unique_ptr<detail::SequencedWriter>> subOutput(resplitSize);
+                for (std::size_t i = 0; i < resplitSize; ++i)
+                {
+                    subParts[i] = root_ / boost::filesystem::unique_path();
+                    subOutput[i].reset(new detail::SequencedWriter(subParts[i]));
+                    // whole blocks are written, they bypass buffer
+                    subOutput[i]->setBufferSize(1);
+                }
+                // block of sub-part is full when its size is a multiple of resplitBlockSize
+                std::vector<Data> blocks(resplitSize * resplitBlockSize);
+                std::vector<HalfData> halfBlock(half ? resplitBlockSize : 0);
+                const auto writeBlock =
+                    [&](const std::size_t sub, const std::size_t blockSize)
+                    {
+                        const Data *const block = blocks.data() + sub * resplitBlockSize;
+                        if (half)
+                        {
+                            std::transform(block, block + blockSize, halfBlock.begin(),
+                                           [](const Data x) { return static_cast<HalfData>(x); });
+                            subOutput[sub]->write(halfBlock.data(), blockSize);
+                        }
+                        else
+                        {
+                            subOutput[sub]->write(block, blockSize);
+                        }
+                    };
+                readPart<Data>(part, inputReaderBufferSize_, bytesRead_,
+                    [&](const Data *const data, const std::size_t size_)
+                    {
+                        for (std::size_t i = 0; i < size_; ++i)
+                        {
+                            const std::size_t sub = (data[i] >> shift) & resplitMask;
+                            blocks[sub * resplitBlockSize + subSize[sub]++ % resplitBlockSize] = data[i];
+                            if (subSize[sub] % resplitBlockSize == 0)
+                                writeBlock(sub, resplitBlockSize);
+                        }
+                    });
+                for (std::size_t i = 0; i < resplitSize; ++i)
+                {
+                    writeBlock(i, subSize[i] % resplitBlockSize);
+                    subOutput[i]->close();
+                }
             }
+            for (std::size_t i = 0; i < resplitSize; ++i)
+                mergePart(subParts[i], subSize[i], (prefix << resplitBitSize) | i, output, sorter);
         }
-        output.close();
     }
 
     void BalancedSplitSorter::inputReader()
@@ -308,9 +1005,10 @@ namespace yandex{namespace intern{namespace sorters
                 {
                     detail::SequencedReader input(source());
                     inputByteSize_ = input.size();
+                    const bool firstPass = &to == &inputForBuildPrefixSplit_;
                     while (!input.eof())
                     {
-                        std::vector<Data> data(inputReaderBufferSize);
+                        std::vector<Data> data(inputReaderBufferSize_);
                         std::size_t actuallyRead;
                         if (!input.read(data.data(), data.size(), &actuallyRead))
                         {
@@ -318,6 +1016,9 @@ namespace yandex{namespace intern{namespace sorters
                                 BOOST_THROW_EXCEPTION(InvalidFileSizeError() << InvalidFileSizeError::path(source()));
                             data.resize(actuallyRead / sizeof(Data));
                         }
+                        bytesRead_ += data.size() * sizeof(Data);
+                        if (firstPass)
+                            inputRuns_.add(data.data(), data.size());
                         to.push(std::move(data));
                     }
                     to.close();
@@ -328,7 +1029,16 @@ namespace yandex{namespace intern{namespace sorters
                 }
             };
         // no exceptions here
-        readInput(inputForBuildPrefixSplit_);
+        if (!prefixSampling_)
+        {
+            readInput(inputForBuildPrefixSplit_);
+            // input is copied by copyPresorted()
+            if (inputRuns_.isSorted() || inputRuns_.isReversed())
+            {
+                inputForSplit_.close();
+                return;
+            }
+        }
         readInput(inputForSplit_);
     }
 
@@ -341,14 +1051,41 @@ namespace yandex{namespace intern{namespace sorters
                 if (!isCountSorted_[i])
                 {
                     output[i].reset(new detail::SequencedWriter(id2part_[i]));
-                    output[i]->resize(sizeof(Data) * id2size_[i]);
+                    output[i]->resize(partElementSize(id2prefix_[i]) * id2size_[i]);
                 }
+            std::vector<std::size_t> written(id2part_.size());
+            std::vector<HalfData> halfData;
             PartWriteTask task;
             while (partOutput_.pop(task))
-                output[task.id]->write(task.data.data(), task.data.size());
+            {
+                if (isHalfPart(id2prefix_[task.id]))
+                {
+                    // common prefix is restored by merge()
+                    halfData.resize(task.data.size());
+                    std::transform(task.data.begin(), task.data.end(), halfData.begin(),
+                                   [](const Data data) { return static_cast<HalfData>(data); });
+                    output[task.id]->write(halfData.data(), halfData.size());
+                }
+                else
+                {
+                    output[task.id]->write(task.data.data(), task.data.size());
+                }
+                written[task.id] += task.data.size();
+            }
             for (std::size_t i = 0; i < output.size(); ++i)
+            {
                 if (output[i])
+                {
+                    // sizes are estimated if prefix mapping was built from sample
+                    if (written[i] != id2size_[i])
+                    {
+                        output[i]->flush();
+                        output[i]->truncate(partElementSize(id2prefix_[i]) * written[i]);
+                        id2size_[i] = written[i];
+                    }
                     output[i]->close();
+                }
+            }
         }
         catch (...)
         {
@@ -10,6 +10,7 @@
 
 #include "bunsan/enable_error_info.hpp"
 #include "bunsan/filesystem/fstream.hpp"
+#include "bunsan/logging/legacy.hpp"
 
 #include <boost/filesystem/operations.hpp>
 
@@ -20,11 +21,34 @@
 
 namespace yandex{namespace intern{namespace sorters
 {
-    InMemorySorter::InMemorySorter(const boost::filesystem::path& src, const boost::filesystem::path& dst):
-        Sorter(src, dst) {}
+    InMemorySorter::InMemorySorter(const boost::filesystem::path& src, const boost::filesystem::path& dst,
+                                   const std::size_t memoryLimitBytes):
+        Sorter(src, dst, memoryLimitBytes) {}
+
+    std::size_t InMemorySorter::memoryRequired(const std::size_t inputByteSize)
+    {
+        // mapped file is sorted in place
+        return inputByteSize;
+    }
+
+    std::size_t InMemorySorter::memoryPreferred(const std::size_t inputByteSize)
+    {
+        // mapped file and radix scratch
+        return 2 * inputByteSize;
+    }
 
     void InMemorySorter::sort()
     {
-        detail::radix::sortFile(source(), destination());
+        const std::size_t inputByteSize = boost::filesystem::file_size(source());
+        const std::size_t memoryRequired_ = memoryRequired(inputByteSize);
+        if (memoryRequired_ > memoryLimitBytes())
+            BOOST_THROW_EXCEPTION(MemoryLimitExceededError() <<
+                                  MemoryLimitExceededError::memoryLimit(memoryLimitBytes()) <<
+                                  MemoryLimitExceededError::memoryRequired(memoryRequired_) <<
+                                  MemoryLimitExceededError::path(source()));
+        const detail::RunDetector runs = memoryPreferred(inputByteSize) <= memoryLimitBytes() ?
+            detail::radix::sortFile(source(), destination()) :
+            detail::radix::sortFileInPlace(source(), destination());
+        SLOG("Input is " << runs << ".");
     }
 }}}
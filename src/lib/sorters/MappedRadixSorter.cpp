@@ -0,0 +1,225 @@
+#include "yandex/intern/sorters/MappedRadixSorter.hpp"
+#include "yandex/intern/Error.hpp"
+
+#include "yandex/intern/detail/FileMemoryMap.hpp"
+#include "yandex/intern/detail/SequencedReader.hpp"
+#include "yandex/intern/detail/SequencedWriter.hpp"
+
+#include "bunsan/logging/legacy.hpp"
+
+#include <boost/filesystem/operations.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+namespace yandex{namespace intern{namespace sorters
+{
+    namespace
+    {
+        constexpr std::size_t buckets = detail::radix::bucketsSize;
+
+        inline std::size_t digit(const Data value, const std::size_t block)
+        {
+            return (value >> (block * detail::radix::blockBitSize)) & detail::radix::mask;
+        }
+
+        /// Kernel maps this aligned block around faulted page (fault-around).
+        constexpr std::size_t minWindowByteSize = 64 * 1024;
+
+        /*!
+         * \brief Every cursor holds a window, half of memory is used.
+         *
+         * Windows are aligned powers of two not less than minWindowByteSize,
+         * so fault in a window never maps pages of the previous one.
+         */
+        std::size_t windowSize(const std::size_t memoryLimitBytes)
+        {
+            std::size_t windowByteSize = minWindowByteSize;
+            while (2 * windowByteSize * 2 * buckets <= memoryLimitBytes)
+                windowByteSize *= 2;
+            return windowByteSize / sizeof(Data);
+        }
+
+        /// End of aligned window containing data[i], at most size.
+        std::size_t alignedWindowEnd(const Data *const data, const std::size_t i,
+                                     const std::size_t size, const std::size_t windowSize)
+        {
+            const std::size_t offset = reinterpret_cast<std::uintptr_t>(data + i) / sizeof(Data) % windowSize;
+            return std::min(i + windowSize - offset, size);
+        }
+
+        /// Advice is a hint, errors are ignored.
+        void advise(const Data *const data, const std::size_t size, const int advice)
+        {
+            static const std::uintptr_t pageMask = sysconf(_SC_PAGESIZE) - 1;
+            const std::uintptr_t begin = reinterpret_cast<std::uintptr_t>(data) & ~pageMask;
+            const std::uintptr_t end = (reinterpret_cast<std::uintptr_t>(data + size) + pageMask) & ~pageMask;
+            if (begin < end)
+                madvise(reinterpret_cast<void *>(begin), end - begin, advice);
+        }
+    }
+
+    MappedRadixSorter::MappedRadixSorter(const boost::filesystem::path &src, const boost::filesystem::path &dst,
+                                         const std::size_t memoryLimitBytes):
+        Sorter(src, dst, memoryLimitBytes),
+        // range and radix scratch
+        maxInMemorySize_(memoryLimitBytes / 2 / sizeof(Data)),
+        windowSize_(windowSize(memoryLimitBytes)) {}
+
+    std::size_t MappedRadixSorter::spaceRequired(const std::size_t inputByteSize, const bool inPlace)
+    {
+        return inPlace ? 0 : inputByteSize;
+    }
+
+    void MappedRadixSorter::sort()
+    {
+        const bool inPlace = boost::filesystem::exists(destination()) &&
+                             boost::filesystem::equivalent(source(), destination());
+        const std::size_t highestBlock = detail::radix::iterations - 1;
+        Histogram histogram;
+        std::size_t size;
+        if (inPlace)
+        {
+            const std::size_t byteSize = boost::filesystem::file_size(source());
+            if (byteSize % sizeof(Data) != 0)
+                BOOST_THROW_EXCEPTION(InvalidFileSizeError() << InvalidFileSizeError::path(source()));
+            size = byteSize / sizeof(Data);
+        }
+        else
+        {
+            SLOG("Copying source to destination.");
+            size = copyCounting(highestBlock, histogram);
+        }
+        if (!size)
+            return;
+        SLOG("Sorting " << size << " elements in place using " << windowSize_ * sizeof(Data) <<
+             " bytes windows, ranges of at most " << maxInMemorySize_ << " elements are sorted in memory.");
+        detail::FileMemoryMap map(destination(), O_RDWR, PROT_READ | PROT_WRITE, MAP_SHARED);
+        sortRange(static_cast<Data *>(map.data()), size, detail::radix::iterations, inPlace ? nullptr : &histogram);
+        map.close();
+    }
+
+    std::size_t MappedRadixSorter::copyCounting(const std::size_t block, Histogram &histogram)
+    {
+        histogram.fill(0);
+        detail::SequencedReader input(source());
+        detail::SequencedWriter output(destination());
+        if (input.size() % sizeof(Data) != 0)
+            BOOST_THROW_EXCEPTION(InvalidFileSizeError() << InvalidFileSizeError::path(source()));
+        const std::size_t size = input.size() / sizeof(Data);
+        output.resize(input.size());
+        std::vector<Data> buffer(std::min(size, maxInMemorySize_));
+        for (std::size_t begin = 0; begin < size; begin += buffer.size())
+        {
+            buffer.resize(std::min(buffer.size(), size - begin));
+            if (!input.read(buffer.data(), buffer.size()))
+                BOOST_THROW_EXCEPTION(InvalidFileSizeError() << InvalidFileSizeError::path(source()));
+            for (const Data x: buffer)
+                ++histogram[digit(x, block)];
+            output.write(buffer.data(), buffer.size());
+        }
+        output.close();
+        input.close();
+        return size;
+    }
+
+    void MappedRadixSorter::count(const Data *const data, const std::size_t size,
+                                  const std::size_t block, Histogram &histogram)
+    {
+        histogram.fill(0);
+        advise(data, alignedWindowEnd(data, 0, size, windowSize_), MADV_WILLNEED);
+        for (std::size_t begin = 0, end; begin < size; begin = end)
+        {
+            end = alignedWindowEnd(data, begin, size, windowSize_);
+            if (end < size)
+                advise(data + end, alignedWindowEnd(data, end, size, windowSize_) - end, MADV_WILLNEED);
+            for (std::size_t i = begin; i < end; ++i)
+                ++histogram[digit(data[i], block)];
+            advise(data + begin, end - begin, MADV_DONTNEED);
+        }
+    }
+
+    void MappedRadixSorter::sortRange(Data *const data, const std::size_t size,
+                                      const std::size_t endBlock, const Histogram *histogram)
+    {
+        if (!endBlock)
+            return;
+        if (size <= maxInMemorySize_)
+        {
+            advise(data, size, MADV_WILLNEED);
+            if (!sorter_.sort(data, size, 0, endBlock, detail::radix::parallelThreads()))
+                detail::radix::sortInPlace(data, size, 0, endBlock, detail::radix::parallelThreads());
+            // shared pages are kept in page cache
+            advise(data, size, MADV_DONTNEED);
+            return;
+        }
+        const std::size_t block = endBlock - 1;
+        Histogram counted;
+        if (!histogram)
+        {
+            count(data, size, block, counted);
+            histogram = &counted;
+        }
+        if (std::find(histogram->begin(), histogram->end(), size) != histogram->end())
+        {
+            // block is equal for all elements
+            sortRange(data, size, block, nullptr);
+            return;
+        }
+        SLOG("Permuting " << size << " elements by block " << block << ".");
+        Histogram bucketEnd;
+        permute(data, size, block, *histogram, bucketEnd);
+        for (std::size_t bucket = 0, begin = 0; bucket < buckets; begin = bucketEnd[bucket++])
+            sortRange(data + begin, bucketEnd[bucket] - begin, block, nullptr);
+    }
+
+    void MappedRadixSorter::permute(Data *const data, const std::size_t size, const std::size_t block,
+                                    const Histogram &histogram, Histogram &bucketEnd)
+    {
+        Histogram head, windowBegin, windowEnd;
+        for (std::size_t i = 0, allocated = 0; i < buckets; ++i)
+        {
+            head[i] = allocated;
+            allocated += histogram[i];
+            bucketEnd[i] = allocated;
+            windowBegin[i] = head[i];
+            windowEnd[i] = alignedWindowEnd(data, head[i], bucketEnd[i], windowSize_);
+            advise(data + head[i], windowEnd[i] - head[i], MADV_WILLNEED);
+        }
+        BOOST_ASSERT(bucketEnd[buckets - 1] == size);
+        // cursor leaves its window: processed one is dropped, next one is read ahead
+        const auto advance =
+            [&](const std::size_t bucket)
+            {
+                if (++head[bucket] == windowEnd[bucket])
+                {
+                    advise(data + windowBegin[bucket], head[bucket] - windowBegin[bucket], MADV_DONTNEED);
+                    windowBegin[bucket] = head[bucket];
+                    windowEnd[bucket] = alignedWindowEnd(data, head[bucket], bucketEnd[bucket], windowSize_);
+                    advise(data + head[bucket], windowEnd[bucket] - head[bucket], MADV_WILLNEED);
+                }
+            };
+        // every element is moved at most once to its bucket
+        for (std::size_t bucket = 0; bucket < buckets; ++bucket)
+        {
+            while (head[bucket] < bucketEnd[bucket])
+            {
+                Data value = data[head[bucket]];
+                std::size_t to = digit(value, block);
+                while (to != bucket)
+                {
+                    std::swap(value, data[head[to]]);
+                    advance(to);
+                    to = digit(value, block);
+                }
+                data[head[bucket]] = value;
+                advance(bucket);
+            }
+        }
+    }
+}}}
@@ -2,8 +2,12 @@
 #include "yandex/intern/Error.hpp"
 #include "yandex/intern/types.hpp"
 #include "yandex/intern/detail/FileMemoryMap.hpp"
+#include "yandex/intern/detail/coRank.hpp"
 #include "yandex/intern/detail/io.hpp"
+#include "yandex/intern/detail/LoserTree.hpp"
+#include "yandex/intern/detail/RadixSorter.hpp"
 #include "yandex/intern/detail/radixSort.hpp"
+#include "yandex/intern/detail/RunDetector.hpp"
 #include "yandex/intern/detail/SequencedReader.hpp"
 #include "yandex/intern/detail/SequencedWriter.hpp"
 
@@ -19,7 +23,10 @@
 #include <boost/optional.hpp>
 #include <boost/filesystem/operations.hpp>
 
+#include <algorithm>
 #include <array>
+#include <deque>
+#include <exception>
 #include <queue>
 #include <vector>
 #include <utility>
@@ -32,46 +39,173 @@ namespace yandex{namespace intern{namespace sorters
 {
     namespace unistd = contest::system::unistd;
 
-    constexpr std::size_t memoryLimitBytes = 256 * 1024 * 1024;
-    constexpr std::size_t fileSizeLimitBytes = memoryLimitBytes / 4;
-    static_assert(fileSizeLimitBytes % sizeof(Data) == 0, "");
-    constexpr std::size_t blockSizeLimitBytes = fileSizeLimitBytes / sizeof(Data);
+    /*
+     * Memory is split into memoryParts equal blocks.
+     *
+     * split() holds 1 block, smallSortTasks_ holds smallSortQueueSize blocks,
+     * every sortSmall() thread holds 2 blocks (data and radix buffer),
+     * dumpSmallTasks_ holds dumpSmallQueueSize blocks and dumpSmall() holds up to 3 blocks.
+     * Remaining blocks are used by merge() buffers,
+     * merge input buffer is split in halves for read-ahead.
+     */
+    constexpr std::size_t sortSmallThreads = 3;
+    constexpr std::size_t smallSortQueueSize = 2;
+    constexpr std::size_t dumpSmallQueueSize = 2;
+    constexpr std::size_t blocksInUse = 1 + smallSortQueueSize + 2 * sortSmallThreads + dumpSmallQueueSize + 3;
+    constexpr std::size_t memoryParts = 16;
+    static_assert(blocksInUse < memoryParts, "");
+    constexpr std::size_t mergeMemoryParts = memoryParts - blocksInUse;
 
-    const std::size_t mergeNumberLimit = std::min(memoryLimitBytes / (4 * BUFSIZ * sizeof(Data)), static_cast<std::size_t>(unistd::getdtablesize()) / 2);
+    constexpr std::size_t minMergeBufferByteSize = 64 * 1024;
+    constexpr std::size_t maxMergeBufferByteSize = 1024 * 1024;
+    constexpr std::size_t mergeBuffersPerMemory = 64;
+
+    /*
+     * Replacement selection holds heap instead of split(), sortSmall() and dumpSmall() blocks,
+     * input and output buffers are of merge buffer size.
+     */
+    constexpr std::size_t heapMemoryParts = blocksInUse - 2;
+
+    /// Automatic run generation uses replacement selection if average run of the first block is not shorter.
+    constexpr std::size_t minReplacementSelectionRunLength = 16;
+
+    /// Merge is split into parts of at least this number of elements, one per thread.
+    constexpr std::size_t minParallelMergePartSize = 1024 * 1024;
+    constexpr std::size_t minParallelMergeBufferByteSize = 32 * 1024;
+
+    namespace
+    {
+        std::size_t blockSize(const std::size_t memoryLimitBytes)
+        {
+            return memoryLimitBytes / memoryParts / sizeof(Data);
+        }
+
+        std::size_t mergeMemoryByteSize(const std::size_t memoryLimitBytes)
+        {
+            return memoryLimitBytes / memoryParts * mergeMemoryParts;
+        }
+
+        std::size_t mergeBufferByteSize(const std::size_t memoryLimitBytes)
+        {
+            std::size_t size = mergeMemoryByteSize(memoryLimitBytes) / mergeBuffersPerMemory;
+            size = std::min(size, maxMergeBufferByteSize);
+            size = std::max(size, minMergeBufferByteSize);
+            return size - size % sizeof(Data);
+        }
+
+        /// Heap capacity is reserved, every element may be moved to tail.
+        std::size_t heapSize(const std::size_t memoryLimitBytes)
+        {
+            return memoryLimitBytes / memoryParts * heapMemoryParts / (sizeof(std::uint64_t) + sizeof(Data));
+        }
+
+        /// Descriptors available to a merge, the rest is left for run generation.
+        std::size_t mergeDescriptors()
+        {
+            return static_cast<std::size_t>(unistd::getdtablesize()) / 2;
+        }
+
+        std::size_t mergeNumberLimit(const std::size_t memoryLimitBytes)
+        {
+            // one buffer and one descriptor are used by output
+            const std::size_t buffers = mergeMemoryByteSize(memoryLimitBytes) / mergeBufferByteSize(memoryLimitBytes);
+            return std::max<std::size_t>(std::min(buffers, mergeDescriptors()) - 1, 2);
+        }
+    }
 
     namespace
     {
+        /*!
+         * Sources provide inputs by batches:
+         * next(n, begin, end) sets [begin, end) to nonempty batch of input n
+         * which is valid until the next call for n, false is returned if input is exhausted.
+         */
+        /*!
+         * Every run is double buffered, I/O thread reads the next block ahead
+         * for the run which is forecasted to be exhausted first:
+         * the one whose last read element is the least (Knuth's forecasting).
+         */
         class FilesSource: private boost::noncopyable
         {
         public:
-            inline explicit FilesSource(const std::vector<boost::filesystem::path> &files):
-                files_(files),
+            /// Elements [begins[i], ends[i]) of files[i] are used, bufferSize is shared by run blocks.
+            inline FilesSource(const std::vector<boost::filesystem::path> &files,
+                               const std::vector<std::size_t> &begins,
+                               const std::vector<std::size_t> &ends,
+                               const std::size_t bufferSize):
                 inputs_(files.size())
             {
+                const std::size_t blockSize = std::max<std::size_t>(bufferSize / 2 / sizeof(Data), 1);
                 for (std::size_t i = 0; i < files.size(); ++i)
                 {
-                    inputs_[i].reset(new detail::SequencedReader(files[i]));
-                    inputs_[i]->setBufferSize(1024 * 1024);
-                    const std::size_t sizeI = inputs_[i]->size();
-                    BOOST_ASSERT(sizeI % sizeof(Data) == 0);
-                    outputSize_ += sizeI / sizeof(Data);
+                    Input &input = inputs_[i];
+                    input.reader.reset(new detail::SequencedReader(files[i]));
+                    BOOST_ASSERT(begins[i] <= ends[i]);
+                    BOOST_ASSERT(ends[i] * sizeof(Data) <= input.reader->size());
+                    if (begins[i])
+                        input.reader->seek(begins[i] * sizeof(Data));
+                    input.left = ends[i] - begins[i];
+                    input.blockSize = std::min(blockSize, input.left);
+                    outputSize_ += input.left;
+                    // the first block is read synchronously
+                    input.left -= readBlock(input, input.blocks[0]);
+                    if (input.left)
+                        forecast_.emplace(input.blocks[0].back(), i);
                 }
+                reader_ = boost::thread(&FilesSource::prefetch, this);
             }
 
-            inline bool next(const std::size_t n, Data &next)
+            inline ~FilesSource()
             {
-                std::size_t actuallyRead_;
-                if (inputs_[n]->read(next, &actuallyRead_))
                 {
-                    return true;
+                    const boost::lock_guard<boost::mutex> lk(lock_);
+                    stop_ = true;
+                }
+                forecasted_.notify_one();
+                reader_.join();
+            }
+
+            inline bool next(const std::size_t n, const Data *&begin, const Data *&end)
+            {
+                Input &input = inputs_[n];
+                if (!input.started)
+                {
+                    input.started = true;
+                    if (!input.blocks[0].empty())
+                    {
+                        begin = input.blocks[0].data();
+                        end = begin + input.blocks[0].size();
+                        return true;
+                    }
                 }
                 else
                 {
-                    BOOST_ASSERT(actuallyRead_ == 0);
-                    inputs_[n]->close();
-                    boost::filesystem::remove(files_[n]);
-                    return false;
+                    boost::unique_lock<boost::mutex> lk(lock_);
+                    prefetched_.wait(lk, [&]() { return error_ || input.prefetched || !input.left; });
+                    if (error_)
+                        std::rethrow_exception(error_);
+                    if (input.prefetched)
+                    {
+                        input.prefetched = false;
+                        input.current ^= 1;
+                        const std::vector<Data> &block = input.blocks[input.current];
+                        if (input.left)
+                        {
+                            // previous block is free to be filled
+                            forecast_.emplace(block.back(), n);
+                            forecasted_.notify_one();
+                        }
+                        begin = block.data();
+                        end = begin + block.size();
+                        return true;
+                    }
                 }
+                for (std::vector<Data> &block: input.blocks)
+                {
+                    block.clear();
+                    block.shrink_to_fit();
+                }
+                return false;
             }
 
             inline std::size_t inputNumber() const
@@ -85,9 +219,78 @@ namespace yandex{namespace intern{namespace sorters
             }
 
         private:
-            const std::vector<boost::filesystem::path> &files_;
-            std::vector<std::unique_ptr<detail::SequencedReader>> inputs_;
+            struct Input
+            {
+                std::unique_ptr<detail::SequencedReader> reader;
+                std::array<std::vector<Data>, 2> blocks;
+                std::size_t current = 0;
+                std::size_t blockSize = 0;
+                std::size_t left = 0; ///< not read elements
+                bool started = false;
+                bool prefetched = false; ///< the other block is ready
+            };
+
+            /// Is not synchronized, input.left is decreased by caller.
+            inline std::size_t readBlock(Input &input, std::vector<Data> &block)
+            {
+                const std::size_t size = std::min(input.blockSize, input.left);
+                block.resize(size);
+                if (!input.reader->read(block.data(), size))
+                    BOOST_THROW_EXCEPTION(InvalidFileSizeError());
+                if (size == input.left)
+                    input.reader->close();
+                return size;
+            }
+
+            void prefetch()
+            {
+                try
+                {
+                    for (;;)
+                    {
+                        Input *input;
+                        std::vector<Data> *block;
+                        {
+                            boost::unique_lock<boost::mutex> lk(lock_);
+                            forecasted_.wait(lk, [this]() { return stop_ || !forecast_.empty(); });
+                            if (stop_)
+                                return;
+                            input = &inputs_[forecast_.top().second];
+                            forecast_.pop();
+                            block = &input->blocks[input->current ^ 1];
+                        }
+                        const std::size_t size = readBlock(*input, *block);
+                        {
+                            const boost::lock_guard<boost::mutex> lk(lock_);
+                            input->left -= size;
+                            input->prefetched = true;
+                        }
+                        prefetched_.notify_one();
+                    }
+                }
+                catch (...)
+                {
+                    {
+                        const boost::lock_guard<boost::mutex> lk(lock_);
+                        error_ = std::current_exception();
+                    }
+                    prefetched_.notify_one();
+                }
+            }
+
+        private:
+            std::vector<Input> inputs_;
             std::size_t outputSize_ = 0;
+
+            boost::mutex lock_;
+            boost::condition_variable forecasted_, prefetched_;
+            /// last read element and run, for runs with free block
+            std::priority_queue<std::pair<Data, std::size_t>,
+                                std::vector<std::pair<Data, std::size_t>>,
+                                std::greater<std::pair<Data, std::size_t>>> forecast_;
+            bool stop_ = false;
+            std::exception_ptr error_;
+            boost::thread reader_;
         };
 
         class VectorSource: private boost::noncopyable
@@ -95,27 +298,27 @@ namespace yandex{namespace intern{namespace sorters
         public:
             inline explicit VectorSource(std::vector<std::vector<Data>> &inputs):
                 inputs_(inputs),
-                pos_(inputs.size())
+                taken_(inputs.size(), false)
             {
                 for (const std::vector<Data> &data: inputs)
                     outputSize_ += data.size();
             }
 
-            inline bool next(const std::size_t n, Data &next)
+            /// Whole input is the only batch, it is freed on the next call.
+            inline bool next(const std::size_t n, const Data *&begin, const Data *&end)
             {
-                BOOST_ASSERT(n < pos_.size());
-                if (pos_[n] < inputs_[n].size())
+                BOOST_ASSERT(n < taken_.size());
+                if (!taken_[n] && !inputs_[n].empty())
                 {
-                    next = inputs_[n][pos_[n]++];
-                    if (pos_[n] == inputs_[n].size())
-                    {
-                        inputs_[n].clear();
-                        inputs_[n].shrink_to_fit();
-                    }
+                    taken_[n] = true;
+                    begin = inputs_[n].data();
+                    end = begin + inputs_[n].size();
                     return true;
                 }
                 else
                 {
+                    inputs_[n].clear();
+                    inputs_[n].shrink_to_fit();
                     return false;
                 }
             }
@@ -130,23 +333,71 @@ namespace yandex{namespace intern{namespace sorters
                 return outputSize_;
             }
 
-            ~VectorSource()
-            {
-                // TODO free inputs_?
-            }
-
         private:
             std::vector<std::vector<Data>> &inputs_;
-            std::vector<std::size_t> pos_;
+            std::vector<bool> taken_;
             std::size_t outputSize_ = 0;
         };
     }
 
-    SplitMergeSorter::SplitMergeSorter(const boost::filesystem::path& src, const boost::filesystem::path& dst):
-        Sorter(src, dst),
+    namespace
+    {
+        /// Merge source to writer by loser tree, output is written by blocks of bufferByteSize.
+        template <typename Source>
+        void mergeToWriter(Source &source, detail::SequencedWriter &writer, const std::size_t bufferByteSize)
+        {
+            std::vector<const Data *> pos(source.inputNumber()), end(source.inputNumber());
+            const auto pop =
+                [&](const std::size_t n) -> detail::LoserTree::Key
+                {
+                    if (pos[n] == end[n] && !source.next(n, pos[n], end[n]))
+                        return detail::LoserTree::exhausted;
+                    return *pos[n]++;
+                };
+            std::vector<detail::LoserTree::Key> keys(source.inputNumber());
+            for (std::size_t i = 0; i < keys.size(); ++i)
+                keys[i] = pop(i);
+            detail::LoserTree tree(keys);
+            // blocks bypass writer buffer
+            std::vector<Data> block(std::min(bufferByteSize / sizeof(Data), source.outputSize()));
+            std::size_t blockSize = 0;
+            while (!tree.empty())
+            {
+                block[blockSize++] = tree.winnerKey();
+                if (blockSize == block.size())
+                {
+                    writer.write(block.data(), blockSize);
+                    blockSize = 0;
+                }
+                tree.replace(pop(tree.winner()));
+            }
+            writer.write(block.data(), blockSize);
+        }
+
+        /// Merge buffers and descriptors are shared by threads, every thread opens all inputs and output.
+        std::size_t mergeThreads(const std::size_t inputNumber, const std::size_t outputSize,
+                                 const std::size_t mergeBufferByteSize)
+        {
+            std::size_t threads = detail::radix::parallelThreads();
+            threads = std::min(threads, outputSize / minParallelMergePartSize);
+            threads = std::min(threads, mergeBufferByteSize / minParallelMergeBufferByteSize);
+            threads = std::min(threads, mergeDescriptors() / (inputNumber + 1));
+            return std::max<std::size_t>(threads, 1);
+        }
+    }
+
+    SplitMergeSorter::SplitMergeSorter(const boost::filesystem::path& src, const boost::filesystem::path& dst,
+                                       const std::size_t memoryLimitBytes,
+                                       const RunGeneration runGeneration):
+        Sorter(src, dst, memoryLimitBytes),
         root_(dst.parent_path() / boost::filesystem::unique_path()),
-        smallSortTasks_(4),
-        dumpSmallTasks_(4)
+        blockSize_(blockSize(memoryLimitBytes)),
+        mergeBufferByteSize_(mergeBufferByteSize(memoryLimitBytes)),
+        mergeNumberLimit_(mergeNumberLimit(memoryLimitBytes)),
+        heapSize_(heapSize(memoryLimitBytes)),
+        runGeneration_(runGeneration),
+        smallSortTasks_(smallSortQueueSize),
+        dumpSmallTasks_(dumpSmallQueueSize)
     {
         BOOST_VERIFY(boost::filesystem::create_directory(root_)); // directory is new
     }
@@ -156,6 +407,12 @@ namespace yandex{namespace intern{namespace sorters
         boost::filesystem::remove_all(root_);
     }
 
+    std::size_t SplitMergeSorter::spaceRequired(const std::size_t inputByteSize)
+    {
+        // last merge reads runs and writes result to destination
+        return 2 * inputByteSize;
+    }
+
     void SplitMergeSorter::sort()
     {
         main();
@@ -163,24 +420,150 @@ namespace yandex{namespace intern{namespace sorters
 
     void SplitMergeSorter::main()
     {
-        for (std::size_t i = 0; i < 3; ++i)
-            sortSmallGroup_.create_thread(boost::bind(&SplitMergeSorter::sortSmall, this));
-        dumpSmallGroup_.create_thread(boost::bind(&SplitMergeSorter::dumpSmall, this));
-        mergeGroup_.create_thread(boost::bind(&SplitMergeSorter::merge, this)); // single thread
-        split();
-        smallSortTasks_.close();
-        sortSmallGroup_.join_all();
-        dumpSmallTasks_.close();
-        dumpSmallGroup_.join_all();
+        const bool useReplacementSelection =
+            runGeneration_ == RunGeneration::replacementSelection ||
+            (runGeneration_ == RunGeneration::automatic && isNearlySorted());
+        if (useReplacementSelection)
+        {
+            SLOG("Generating runs by replacement selection.");
+            mergeGroup_.create_thread(boost::bind(&SplitMergeSorter::merge, this));
+            replacementSelection();
+        }
+        else
+        {
+            for (std::size_t i = 0; i < sortSmallThreads; ++i)
+                sortSmallGroup_.create_thread(boost::bind(&SplitMergeSorter::sortSmall, this));
+            dumpSmallGroup_.create_thread(boost::bind(&SplitMergeSorter::dumpSmall, this));
+            mergeGroup_.create_thread(boost::bind(&SplitMergeSorter::merge, this)); // single thread, mergeFiles() is parallel
+            split();
+            smallSortTasks_.close();
+            sortSmallGroup_.join_all();
+            dumpSmallTasks_.close();
+            dumpSmallGroup_.join_all();
+        }
         mergeTasks_.close();
         mergeGroup_.join_all();
     }
 
+    bool SplitMergeSorter::isNearlySorted()
+    {
+        // the first block is read twice
+        detail::SequencedReader reader(source());
+        std::vector<Data> data(std::min(blockSize_, reader.size() / sizeof(Data)));
+        if (!reader.read(data.data(), data.size()))
+            BOOST_THROW_EXCEPTION(InvalidFileSizeError() << InvalidFileSizeError::path(source()));
+        reader.close();
+        detail::RunDetector runs(0);
+        runs.add(data.data(), data.size());
+        SLOG("The first block is " << runs << ".");
+        return runs.runs() * minReplacementSelectionRunLength <= runs.size();
+    }
+
+    void SplitMergeSorter::replacementSelection()
+    {
+        typedef std::uint64_t Key; // run number and element
+        detail::SequencedReader reader(source());
+        if (reader.size() % sizeof(Data) != 0)
+            BOOST_THROW_EXCEPTION(InvalidFileSizeError() << InvalidFileSizeError::path(source()));
+        std::size_t left = reader.size() / sizeof(Data);
+        std::vector<Data> input(std::min(mergeBufferByteSize_ / sizeof(Data), left)), output(input.size());
+        std::size_t inputPos = input.size(), inputSize = input.size(), outputSize = 0;
+        const auto read =
+            [&](Data &x) -> bool
+            {
+                if (inputPos == inputSize)
+                {
+                    if (!left)
+                        return false;
+                    inputSize = std::min(input.size(), left);
+                    if (!reader.read(input.data(), inputSize))
+                        BOOST_THROW_EXCEPTION(InvalidFileSizeError() << InvalidFileSizeError::path(source()));
+                    left -= inputSize;
+                    inputPos = 0;
+                }
+                x = input[inputPos++];
+                return true;
+            };
+        /*
+         * Elements of current run are held by heap and tail,
+         * tail is ascending sequence of elements appended in input order,
+         * so (nearly) sorted input does not pay for heap operations.
+         */
+        std::vector<Key> heap;
+        std::deque<Data> tail;
+        heap.reserve(std::min(heapSize_, left));
+        for (Data x; heap.size() < heapSize_ && read(x);)
+            heap.push_back(x);
+        std::make_heap(heap.begin(), heap.end(), std::greater<Key>());
+        Key run = 0;
+        boost::filesystem::path path;
+        std::unique_ptr<detail::SequencedWriter> writer;
+        const auto finishRun =
+            [&]()
+            {
+                writer->write(output.data(), outputSize);
+                outputSize = 0;
+                writer->close();
+                writer.reset();
+                SLOG("Run " << path << " is generated.");
+                mergeTasks_.push(path);
+            };
+        const auto push =
+            [&](const Key key)
+            {
+                heap.push_back(key);
+                std::push_heap(heap.begin(), heap.end(), std::greater<Key>());
+            };
+        while (!heap.empty() || !tail.empty())
+        {
+            if (tail.empty() && (!writer || heap.front() >> detail::radix::dataBitSize != run))
+            {
+                if (writer)
+                    finishRun();
+                run = heap.front() >> detail::radix::dataBitSize;
+                path = root_ / boost::filesystem::unique_path();
+                writer.reset(new detail::SequencedWriter(path));
+            }
+            Data value;
+            if (!tail.empty() && (heap.empty() || heap.front() >> detail::radix::dataBitSize != run ||
+                                  tail.front() <= static_cast<Data>(heap.front())))
+            {
+                value = tail.front();
+                tail.pop_front();
+            }
+            else
+            {
+                value = static_cast<Data>(heap.front());
+                std::pop_heap(heap.begin(), heap.end(), std::greater<Key>());
+                heap.pop_back();
+            }
+            output[outputSize++] = value;
+            if (outputSize == output.size())
+            {
+                writer->write(output.data(), outputSize);
+                outputSize = 0;
+            }
+            Data x;
+            if (read(x))
+            {
+                if (x < value)
+                    push((run + 1) << detail::radix::dataBitSize | x); // can not be appended to current run
+                else if (tail.empty() || tail.back() <= x)
+                    tail.push_back(x);
+                else
+                    push(run << detail::radix::dataBitSize | x);
+            }
+        }
+        if (writer)
+            finishRun();
+        reader.close();
+    }
+
     void SplitMergeSorter::split()
     {
 #if 1
         detail::SequencedReader reader(source());
-        constexpr std::size_t size = blockSizeLimitBytes;
+        const std::size_t size = blockSize_;
         std::vector<Data> data(size);
         std::size_t actuallyRead;
         while (reader.read(data.data(), data.size(), &actuallyRead))
@@ -198,10 +581,11 @@ namespace yandex{namespace intern{namespace sorters
         }
 #else
         detail::FileMemoryMap map(source(), O_RDONLY);
-        for (std::size_t offset = 0; offset < map.fileSize(); offset += fileSizeLimitBytes)
+        const std::size_t blockByteSize = blockSize_ * sizeof(Data);
+        for (std::size_t offset = 0; offset < map.fileSize(); offset += blockByteSize)
         {
             SLOG(__func__ << '(' << ')');
-            const std::size_t size = std::min(fileSizeLimitBytes, map.fileSize() - offset);
+            const std::size_t size = std::min(blockByteSize, map.fileSize() - offset);
             map.mapPart(size, PROT_READ, MAP_PRIVATE, offset);
             smallSortTasks_.push(detail::io::readFromMap(map.map()));
             map.unmap();
@@ -211,11 +595,14 @@ namespace yandex{namespace intern{namespace sorters
 
     void SplitMergeSorter::sortSmall()
     {
+        // blocks are of the same size, scratch is allocated once
+        detail::RadixSorter sorter;
         std::vector<Data> task;
         while (smallSortTasks_.pop(task))
         {
             SLOG(__func__ << '(' << ')');
-            detail::radix::sort(task);
+            if (!sorter.sort(task))
+                detail::radix::sortInPlace(task.data(), task.size());
             //std::sort(task.begin(), task.end());
             dumpSmallTasks_.push(std::move(task));
             SLOG('~' << __func__ << '(' << ')');
@@ -248,53 +635,62 @@ namespace yandex{namespace intern{namespace sorters
 
     void SplitMergeSorter::merge()
     {
-        std::vector<boost::filesystem::path> needMerge1, needMerge2;
-        std::vector<boost::filesystem::path> toMerge;
-        boost::optional<boost::filesystem::path> task;
-        std::vector<boost::filesystem::path> *from = &needMerge1, *to = &needMerge2;
-        while ((task = mergeTasks_.pop()))
+        struct Run
         {
-            toMerge.push_back(task.get());
-            for (std::size_t i = 0; i < mergeNumberLimit; ++i)
-            {
-                task = mergeTasks_.pop();
-                if (!task)
-                    break;
-                toMerge.push_back(task.get());
-            }
-            if (toMerge.size() == 1)
+            std::size_t size;
+            boost::filesystem::path path;
+        };
+        // the least runs are merged first (Huffman)
+        const auto greater = [](const Run &a, const Run &b) { return a.size > b.size; };
+        typedef std::priority_queue<Run, std::vector<Run>, decltype(greater)> Runs;
+        Runs generated(greater), runs(greater);
+        const auto mergeLeast =
+            [&](Runs &queue, const std::size_t number, const boost::filesystem::path &path)
             {
-                from->push_back(toMerge.front());
-            }
-            else
+                std::vector<boost::filesystem::path> from;
+                for (std::size_t i = 0; i < number; ++i)
+                {
+                    from.push_back(queue.top().path);
+                    queue.pop();
+                }
+                mergeFiles(from, path);
+            };
+        const auto mergeLeastToRun =
+            [&](Runs &queue, const std::size_t number)
             {
-                BOOST_ASSERT(!toMerge.empty());
                 const boost::filesystem::path path = root_ / boost::filesystem::unique_path();
-                SLOG(__func__);
-                mergeFiles(toMerge, path);
-                SLOG('~' << __func__);
-                toMerge.clear();
-                from->push_back(path);
-            }
+                mergeLeast(queue, number, path);
+                runs.push({boost::filesystem::file_size(path), path});
+            };
+        boost::optional<boost::filesystem::path> task;
+        while ((task = mergeTasks_.pop()))
+        {
+            generated.push({boost::filesystem::file_size(task.get()), task.get()});
+            /*
+             * Generated runs are merged while others are generated
+             * if at least mergeNumberLimit_ runs remain, so no pass is added.
+             * Merged runs wait for the plan of all runs.
+             */
+            if (generated.size() >= mergeNumberLimit_ &&
+                generated.size() + runs.size() >= 2 * mergeNumberLimit_ - 1)
+                mergeLeastToRun(generated, mergeNumberLimit_);
         }
-        while (from->size() > 1)
+        for (; !generated.empty(); generated.pop())
+            runs.push(generated.top());
+        if (runs.size() <= 1)
         {
-            while (!from->empty())
-            {
-                while (toMerge.size() < mergeNumberLimit && !from->empty())
-                {
-                    toMerge.push_back(from->back());
-                    from->pop_back();
-                }
-                const boost::filesystem::path path = root_ / boost::filesystem::unique_path();
-                mergeFiles(toMerge, path);
-                toMerge.clear();
-                to->push_back(path);
-            }
-            std::swap(from, to);
+            if (runs.empty())
+                detail::SequencedWriter(destination()).close();
+            else
+                boost::filesystem::rename(runs.top().path, destination());
+            return;
         }
-        BOOST_ASSERT(from->size() == 1);
-        boost::filesystem::rename(from->front(), destination());
+        // the first merge is short instead of dummy runs, so that other merges are full
+        std::size_t number = (runs.size() - 2) % (mergeNumberLimit_ - 1) + 2;
+        for (; runs.size() > number; number = mergeNumberLimit_)
+            mergeLeastToRun(runs, number);
+        SLOG("Merging " << runs.size() << " runs to destination.");
+        mergeLeast(runs, runs.size(), destination());
     }
 
     template <typename Source>
@@ -302,61 +698,93 @@ namespace yandex{namespace intern{namespace sorters
     {
         SLOG(__func__ << '(' << source.inputNumber() << ", " << output << ')');
         detail::SequencedWriter writer(output);
-        writer.setBufferSize(1024 * 1024);
         writer.resize(source.outputSize() * sizeof(Data));
-#if 0
-        std::vector<std::size_t> available;
-        std::vector<Data> next(source.inputNumber());
-        for (std::size_t i = 0; i < source.inputNumber(); ++i)
+        mergeToWriter(source, writer, mergeBufferByteSize_);
+        writer.close();
+        SLOG('~' << __func__ << '(' << source.inputNumber() << ", " << output << ')');
+    }
+
+    void SplitMergeSorter::mergeFiles(const std::vector<boost::filesystem::path> &from, const boost::filesystem::path &to)
+    {
+        SLOG(__func__ << '(' << from.size() << ", " << to << ')');
+        std::vector<std::size_t> sizes(from.size());
+        std::size_t outputSize = 0;
+        for (std::size_t i = 0; i < from.size(); ++i)
+        {
+            sizes[i] = boost::filesystem::file_size(from[i]) / sizeof(Data);
+            outputSize += sizes[i];
+        }
+        const std::size_t threads = mergeThreads(from.size(), outputSize, mergeBufferByteSize_);
         {
-            if (source.next(i, next[i]))
-                available.push_back(i);
+            detail::SequencedWriter writer(to);
+            writer.resize(outputSize * sizeof(Data));
+            writer.close();
         }
-        while (!available.empty())
+        // part i is [splitters[i], splitters[i + 1]) of runs
+        std::vector<std::vector<std::size_t>> splitters(threads + 1, std::vector<std::size_t>(from.size(), 0));
+        splitters.back() = sizes;
+        if (threads > 1)
         {
-            std::size_t minI = 0;
-            Data min = next[available[minI]];
-            for (std::size_t i = 1; i < available.size(); ++i)
+            SLOG("Merging " << outputSize << " elements using " << threads << " threads.");
+            // mappings outlive their descriptors and are removed before sources are opened
+            std::vector<detail::MemoryMap> maps;
+            std::vector<detail::SortedRun> runs;
+            for (std::size_t i = 0; i < from.size(); ++i)
             {
-                if (min > next[available[i]])
-                {
-                    min = next[available[i]];
-                    minI = i;
-                }
+                detail::FileMemoryMap file(from[i], O_RDONLY, PROT_READ, MAP_SHARED);
+                maps.push_back(std::move(file.map()));
+                file.close();
+                runs.push_back({static_cast<const Data *>(maps.back().data()), sizes[i]});
             }
-            writer.write(min);
-            if (!source.next(available[minI], next[available[minI]]))
-                available.erase(available.begin() + minI);
+            for (std::size_t part = 1; part < threads; ++part)
+                splitters[part] = detail::coRank(runs, outputSize * part / threads);
         }
-#else
-        typedef std::pair<Data, std::size_t> Pair;
-        std::priority_queue<Pair, std::vector<Pair>, std::greater<Pair>> q;
-        const auto update =
-            [&](const std::size_t n)
+        const auto mergePart =
+            [&](const std::size_t part)
             {
-                Data data;
-                if (source.next(n, data))
-                    q.emplace(data, n);
+                const std::size_t bufferByteSize = mergeBufferByteSize_ / threads;
+                FilesSource source(from, splitters[part], splitters[part + 1], bufferByteSize);
+                std::size_t offset = 0;
+                for (const std::size_t runOffset: splitters[part])
+                    offset += runOffset;
+                detail::SequencedWriter writer(to, 0);
+                writer.seek(offset * sizeof(Data));
+                mergeToWriter(source, writer, bufferByteSize);
+                writer.close();
             };
-        for (std::size_t i = 0; i < source.inputNumber(); ++i)
-            update(i);
-        while (!q.empty())
+        if (threads == 1)
         {
-            const auto data_n = q.top();
-            q.pop();
-            update(data_n.second);
-            writer.write(data_n.first);
+            mergePart(0);
         }
-#endif
-        writer.close();
-        SLOG('~' << __func__ << '(' << source.inputNumber() << ", " << output << ')');
-    }
-
-    void SplitMergeSorter::mergeFiles(const std::vector<boost::filesystem::path> &from, const boost::filesystem::path &to)
-    {
-        SLOG(__func__ << '(' << from.size() << ", " << to << ')');
-        FilesSource source(from);
-        mergeToFile(source, to);
+        else
+        {
+            // parts are disjoint, so threads write at their offsets independently
+            boost::mutex lock;
+            std::exception_ptr error;
+            boost::thread_group workers;
+            for (std::size_t part = 0; part < threads; ++part)
+            {
+                workers.create_thread(
+                    [&, part]()
+                    {
+                        try
+                        {
+                            mergePart(part);
+                        }
+                        catch (...)
+                        {
+                            const boost::lock_guard<boost::mutex> lk(lock);
+                            if (!error)
+                                error = std::current_exception();
+                        }
+                    });
+            }
+            workers.join_all();
+            if (error)
+                std::rethrow_exception(error);
+        }
+        for (const boost::filesystem::path &path: from)
+            boost::filesystem::remove(path);
         SLOG('~' << __func__ << '(' << from.size() << ", " << to << ')');
     }
 }}}
@@ -0,0 +1,65 @@
+#define BOOST_TEST_MODULE LoserTree
+#include <boost/test/unit_test.hpp>
+
+#include "yandex/intern/detail/LoserTree.hpp"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace ya = yandex::intern;
+namespace yad = ya::detail;
+
+BOOST_AUTO_TEST_SUITE(LoserTree)
+
+BOOST_AUTO_TEST_CASE(single)
+{
+    yad::LoserTree tree({5});
+    BOOST_CHECK(!tree.empty());
+    BOOST_CHECK_EQUAL(tree.winner(), 0);
+    BOOST_CHECK_EQUAL(tree.winnerKey(), 5);
+    tree.replace(yad::LoserTree::exhausted);
+    BOOST_CHECK(tree.empty());
+}
+
+BOOST_AUTO_TEST_CASE(exhausted)
+{
+    const yad::LoserTree tree({yad::LoserTree::exhausted, yad::LoserTree::exhausted, yad::LoserTree::exhausted});
+    BOOST_CHECK(tree.empty());
+}
+
+BOOST_AUTO_TEST_CASE(merge)
+{
+    std::mt19937 gen;
+    for (std::size_t k = 1; k <= 33; ++k)
+    {
+        std::vector<std::vector<ya::Data>> runs(k);
+        std::vector<ya::Data> expected;
+        for (std::vector<ya::Data> &run: runs)
+        {
+            // duplicates and empty runs are included
+            run.resize(gen() % 50);
+            for (ya::Data &x: run)
+                x = gen() % 100;
+            std::sort(run.begin(), run.end());
+            expected.insert(expected.end(), run.begin(), run.end());
+        }
+        std::sort(expected.begin(), expected.end());
+        std::vector<std::size_t> pos(k, 0);
+        const auto pop =
+            [&](const std::size_t n) -> yad::LoserTree::Key
+            {
+                return pos[n] < runs[n].size() ? runs[n][pos[n]++] : yad::LoserTree::exhausted;
+            };
+        std::vector<yad::LoserTree::Key> keys(k);
+        for (std::size_t i = 0; i < k; ++i)
+            keys[i] = pop(i);
+        yad::LoserTree tree(keys);
+        std::vector<ya::Data> merged;
+        for (; !tree.empty(); tree.replace(pop(tree.winner())))
+            merged.push_back(tree.winnerKey());
+        BOOST_CHECK(merged == expected);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END() // LoserTree
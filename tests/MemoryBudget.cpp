@@ -0,0 +1,67 @@
+#define BOOST_TEST_MODULE MemoryBudget
+#include <boost/test/unit_test.hpp>
+
+#include "yandex/intern/detail/MemoryBudget.hpp"
+
+#include <boost/thread.hpp>
+
+#include <atomic>
+
+namespace ya = yandex::intern;
+namespace yad = ya::detail;
+
+BOOST_AUTO_TEST_SUITE(MemoryBudget)
+
+BOOST_AUTO_TEST_CASE(acquire)
+{
+    yad::MemoryBudget budget(10);
+    budget.acquire(4);
+    budget.acquire(6);
+    BOOST_CHECK_EQUAL(budget.acquired(), 10);
+    budget.release(10);
+    {
+        const yad::MemoryBudget::Guard guard(budget, 7);
+        BOOST_CHECK_EQUAL(budget.acquired(), 7);
+    }
+    BOOST_CHECK_EQUAL(budget.acquired(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(oversized)
+{
+    yad::MemoryBudget budget(10);
+    const yad::MemoryBudget::Guard guard(budget, 100);
+    BOOST_CHECK_EQUAL(budget.acquired(), 100);
+}
+
+BOOST_AUTO_TEST_CASE(wait)
+{
+    yad::MemoryBudget budget(10);
+    budget.acquire(8);
+    std::atomic<bool> acquired(false);
+    boost::thread thread(
+        [&]()
+        {
+            const yad::MemoryBudget::Guard guard(budget, 5);
+            acquired = true;
+        });
+    boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+    BOOST_CHECK(!acquired);
+    budget.release(8);
+    thread.join();
+    BOOST_CHECK(acquired);
+    BOOST_CHECK_EQUAL(budget.acquired(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(tryAcquire)
+{
+    yad::MemoryBudget budget(10);
+    BOOST_CHECK(budget.tryAcquire(8));
+    BOOST_CHECK(!budget.tryAcquire(3));
+    BOOST_CHECK(budget.tryAcquire(2));
+    BOOST_CHECK_EQUAL(budget.acquired(), 10);
+    budget.release(10);
+    BOOST_CHECK(budget.tryAcquire(100));
+    budget.release(100);
+}
+
+BOOST_AUTO_TEST_SUITE_END() // MemoryBudget
@@ -0,0 +1,80 @@
+#define BOOST_TEST_MODULE PrefixHistogram
+#include <boost/test/unit_test.hpp>
+
+#include "yandex/intern/detail/PrefixHistogram.hpp"
+
+#include <vector>
+
+namespace ya = yandex::intern;
+namespace yad = ya::detail;
+
+BOOST_AUTO_TEST_SUITE(PrefixHistogram)
+
+BOOST_AUTO_TEST_CASE(coarse)
+{
+    yad::PrefixHistogram histogram(1000, 10);
+    const std::vector<ya::Data> data = {0x00000000, 0x0000ffff, 0x00010000, 0xffff0000, 0xffffffff, 0x12345678};
+    histogram.add(data.data(), data.size());
+    histogram.finalize();
+    BOOST_CHECK_EQUAL(histogram.coarse(0x0000), 2);
+    BOOST_CHECK_EQUAL(histogram.coarse(0x0001), 1);
+    BOOST_CHECK_EQUAL(histogram.coarse(0x1234), 1);
+    BOOST_CHECK_EQUAL(histogram.coarse(0xffff), 2);
+    BOOST_CHECK_EQUAL(histogram.coarse(0x0002), 0);
+    BOOST_CHECK(!histogram.isRefined(0x0000));
+    BOOST_CHECK_EQUAL(histogram.refinedNumber(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(refine)
+{
+    yad::PrefixHistogram histogram(1, 1);
+    const std::vector<ya::Data> data = {0x1234ab00, 0x1234ab01, 0x1234cd00, 0x5678ab00};
+    histogram.add(data.data(), data.size());
+    histogram.finalize();
+    BOOST_CHECK_EQUAL(histogram.refinedNumber(), 1);
+    BOOST_REQUIRE(histogram.isRefined(0x1234));
+    BOOST_CHECK(!histogram.isRefined(0x5678));
+    BOOST_CHECK_EQUAL(histogram.coarse(0x1234), 3);
+    BOOST_CHECK_EQUAL(histogram.fine(0x1234, 0xab), 2);
+    BOOST_CHECK_EQUAL(histogram.fine(0x1234, 0xcd), 1);
+    BOOST_CHECK_EQUAL(histogram.fine(0x1234, 0x00), 0);
+    BOOST_CHECK_EQUAL(histogram.coarse(0x5678), 1);
+}
+
+BOOST_AUTO_TEST_CASE(distribute)
+{
+    yad::PrefixHistogram histogram(4, 10);
+    // 3 elements are counted before refinement
+    const std::vector<ya::Data> data = {
+        0x00010100, 0x00010100, 0x00010200,
+        0x00010100, 0x00010100, 0x00010100, 0x00010200
+    };
+    histogram.add(data.data(), data.size());
+    histogram.finalize(10);
+    BOOST_REQUIRE(histogram.isRefined(0x0001));
+    BOOST_CHECK_EQUAL(histogram.coarse(0x0001), 70);
+    BOOST_CHECK_EQUAL(histogram.fine(0x0001, 0x01) + histogram.fine(0x0001, 0x02), 70);
+    BOOST_CHECK_EQUAL(histogram.fine(0x0001, 0x01), 53);
+}
+
+BOOST_AUTO_TEST_CASE(merge)
+{
+    yad::PrefixHistogram histogram(2, 10), other(2, 10);
+    const std::vector<ya::Data> data = {0x00010100, 0x00010200, 0x00020100};
+    const std::vector<ya::Data> otherData = {0x00010100, 0x00020100, 0x00020200};
+    histogram.add(data.data(), data.size());
+    other.add(otherData.data(), otherData.size());
+    BOOST_CHECK(histogram.isRefined(0x0001));
+    BOOST_CHECK(!histogram.isRefined(0x0002));
+    BOOST_CHECK(other.isRefined(0x0002));
+    histogram.merge(other);
+    histogram.finalize();
+    BOOST_CHECK_EQUAL(histogram.refinedNumber(), 2);
+    BOOST_CHECK_EQUAL(histogram.coarse(0x0001), 3);
+    BOOST_CHECK_EQUAL(histogram.coarse(0x0002), 3);
+    BOOST_REQUIRE(histogram.isRefined(0x0002));
+    BOOST_CHECK_EQUAL(histogram.fine(0x0002, 0x01), 0);
+    BOOST_CHECK_EQUAL(histogram.fine(0x0002, 0x02), 3);
+}
+
+BOOST_AUTO_TEST_SUITE_END() // PrefixHistogram
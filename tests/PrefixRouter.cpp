@@ -0,0 +1,152 @@
+#define BOOST_TEST_MODULE PrefixRouter
+#include <boost/test/unit_test.hpp>
+
+#include "testSort.hpp"
+
+#include "yandex/intern/detail/PrefixRouter.hpp"
+
+#include <unordered_map>
+#include <vector>
+
+#include <ctime>
+
+namespace ya = yandex::intern;
+namespace yad = ya::detail;
+
+namespace
+{
+    constexpr std::size_t fineBitSize = yad::PrefixRouter::fineBitSize;
+    constexpr std::size_t suffixBitSize = yad::PrefixRouter::dataBitSize - fineBitSize;
+    constexpr std::size_t prefixSize = std::size_t(1) << fineBitSize;
+
+    /// Random prefix tree in lexical order, fineLeaf is always split to maximum depth.
+    void partition(const std::size_t node, const std::size_t depth, const std::size_t fineLeaf,
+                   std::vector<ya::Data> &id2prefix)
+    {
+        if (depth < fineBitSize &&
+            (depth < 8 || ya::test::rnd(ya::test::rng) % 3 == 0 || (fineLeaf >> (fineBitSize - depth)) == node))
+        {
+            partition(2 * node, depth + 1, fineLeaf, id2prefix);
+            partition(2 * node + 1, depth + 1, fineLeaf, id2prefix);
+        }
+        else
+        {
+            id2prefix.push_back(node);
+        }
+    }
+
+    /// Walk to the root until node is found.
+    struct TreeRouter
+    {
+        explicit TreeRouter(const std::vector<ya::Data> &id2prefix): isEnd(2 * prefixSize)
+        {
+            for (std::size_t id = 0; id < id2prefix.size(); ++id)
+            {
+                isEnd[id2prefix[id]] = true;
+                prefix2id[id2prefix[id]] = id;
+            }
+        }
+
+        std::size_t operator()(const ya::Data data) const
+        {
+            std::size_t prefix = prefixSize + (data >> suffixBitSize);
+            while (!isEnd[prefix])
+                prefix >>= 1;
+            return prefix2id.at(prefix);
+        }
+
+        std::vector<bool> isEnd;
+        std::unordered_map<std::size_t, std::size_t> prefix2id;
+    };
+
+    template <typename Router>
+    std::size_t benchRoute(const Router &router, const std::vector<ya::Data> &data, const char *const name)
+    {
+        constexpr std::size_t iterations = 4;
+        std::size_t checksum = 0;
+        const std::clock_t begin = std::clock();
+        for (std::size_t test = 0; test < iterations; ++test)
+            for (const ya::Data x: data)
+                checksum += router(x);
+        const double time = static_cast<double>(std::clock() - begin) / CLOCKS_PER_SEC;
+        BOOST_TEST_MESSAGE(name << ": " << iterations * data.size() / time << " elements per second.");
+        return checksum;
+    }
+
+    std::size_t benchRouteBatch(const yad::PrefixRouter &router, const std::vector<ya::Data> &data,
+                                const char *const name)
+    {
+        constexpr std::size_t iterations = 4;
+        constexpr std::size_t batchSize = 1024;
+        std::vector<std::uint32_t> ids(batchSize);
+        std::size_t checksum = 0;
+        const std::clock_t begin = std::clock();
+        for (std::size_t test = 0; test < iterations; ++test)
+        {
+            for (std::size_t i = 0; i < data.size(); i += batchSize)
+            {
+                const std::size_t size = std::min(batchSize, data.size() - i);
+                router(data.data() + i, size, ids.data());
+                for (std::size_t j = 0; j < size; ++j)
+                    checksum += ids[j];
+            }
+        }
+        const double time = static_cast<double>(std::clock() - begin) / CLOCKS_PER_SEC;
+        BOOST_TEST_MESSAGE(name << ": " << iterations * data.size() / time << " elements per second.");
+        return checksum;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(PrefixRouter)
+
+BOOST_AUTO_TEST_CASE(route)
+{
+    const std::size_t fineLeaf = 0x123456;
+    std::vector<ya::Data> id2prefix;
+    partition(1, 0, fineLeaf | prefixSize, id2prefix);
+    const yad::PrefixRouter router(id2prefix);
+    const TreeRouter treeRouter(id2prefix);
+    BOOST_TEST_MESSAGE(id2prefix.size() << " parts, " << router.refinedNumber() << " refined.");
+    BOOST_CHECK_GE(router.refinedNumber(), 1);
+    BOOST_CHECK_EQUAL(id2prefix[router(fineLeaf << suffixBitSize)], fineLeaf | prefixSize);
+    const std::vector<ya::Data> data = ya::test::generate(1024 * 1024);
+    for (const ya::Data x: data)
+        BOOST_REQUIRE_EQUAL(router(x), treeRouter(x));
+    for (ya::Data x = (fineLeaf - 1) << suffixBitSize; x < (fineLeaf + 2) << suffixBitSize; ++x)
+        BOOST_REQUIRE_EQUAL(router(x), treeRouter(x));
+}
+
+BOOST_AUTO_TEST_CASE(batch)
+{
+    std::vector<ya::Data> id2prefix;
+    partition(1, 0, 0x123456 | prefixSize, id2prefix);
+    const yad::PrefixRouter router(id2prefix);
+    std::vector<ya::Data> data = ya::test::generate(1000);
+    for (ya::Data x = 0x123400; x < 0x123500; ++x)
+        data.push_back(x << suffixBitSize);
+    std::vector<std::uint32_t> ids(data.size());
+    router(data.data(), data.size(), ids.data());
+    for (std::size_t i = 0; i < data.size(); ++i)
+        BOOST_REQUIRE_EQUAL(ids[i], router(data[i]));
+}
+
+BOOST_AUTO_TEST_CASE(single)
+{
+    const yad::PrefixRouter router({1});
+    BOOST_CHECK_EQUAL(router(0), 0);
+    BOOST_CHECK_EQUAL(router(0xffffffff), 0);
+    BOOST_CHECK_EQUAL(router.refinedNumber(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(throughput)
+{
+    std::vector<ya::Data> id2prefix;
+    partition(1, 0, 0x123456 | prefixSize, id2prefix);
+    const std::vector<ya::Data> data = ya::test::generate(16 * 1024 * 1024);
+    const yad::PrefixRouter router(id2prefix);
+    const std::size_t checksum = benchRoute(router, data, "PrefixRouter");
+    BOOST_CHECK_EQUAL(benchRoute(TreeRouter(id2prefix), data, "isEnd walk and hash lookup"), checksum);
+    BOOST_CHECK_EQUAL(benchRouteBatch(router, data, "PrefixRouter by batches"), checksum);
+}
+
+BOOST_AUTO_TEST_SUITE_END() // PrefixRouter
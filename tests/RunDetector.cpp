@@ -0,0 +1,85 @@
+#define BOOST_TEST_MODULE RunDetector
+#include <boost/test/unit_test.hpp>
+
+#include "yandex/intern/detail/RunDetector.hpp"
+
+#include <sstream>
+#include <vector>
+
+namespace ya = yandex::intern;
+namespace yad = ya::detail;
+
+BOOST_AUTO_TEST_SUITE(RunDetector)
+
+BOOST_AUTO_TEST_CASE(empty)
+{
+    const yad::RunDetector runs;
+    BOOST_CHECK(runs.isSorted());
+    BOOST_CHECK_EQUAL(runs.size(), 0);
+    BOOST_CHECK_EQUAL(runs.runs(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(sorted)
+{
+    const std::vector<ya::Data> data = {1, 2, 2, 3, 5, 8};
+    yad::RunDetector runs;
+    // blocks are joined
+    runs.add(data.data(), 3);
+    runs.add(data.data() + 3, 3);
+    BOOST_CHECK(runs.isSorted());
+    BOOST_CHECK(!runs.isReversed());
+    BOOST_CHECK_EQUAL(runs.size(), data.size());
+    BOOST_CHECK_EQUAL(runs.runs(), 1);
+    BOOST_CHECK(runs.runEnds() == std::vector<std::size_t>({6}));
+}
+
+BOOST_AUTO_TEST_CASE(reversed)
+{
+    const std::vector<ya::Data> data = {8, 5, 5, 3, 2, 1};
+    yad::RunDetector runs;
+    runs.add(data.data(), 2);
+    runs.add(data.data() + 2, 4);
+    BOOST_CHECK(!runs.isSorted());
+    BOOST_CHECK(runs.isReversed());
+    BOOST_CHECK_EQUAL(runs.runs(), 5);
+}
+
+BOOST_AUTO_TEST_CASE(equal)
+{
+    const std::vector<ya::Data> data(10, 7);
+    yad::RunDetector runs;
+    runs.add(data.data(), data.size());
+    BOOST_CHECK(runs.isSorted());
+    BOOST_CHECK(runs.isReversed());
+}
+
+BOOST_AUTO_TEST_CASE(runEnds)
+{
+    const std::vector<ya::Data> data = {1, 4, 9, 2, 3, 0, 5, 6, 7};
+    yad::RunDetector runs(3);
+    // run boundary between blocks
+    runs.add(data.data(), 5);
+    runs.add(data.data() + 5, 4);
+    BOOST_CHECK_EQUAL(runs.runs(), 3);
+    BOOST_CHECK(runs.runEnds() == std::vector<std::size_t>({3, 5, 9}));
+    const ya::Data more[] = {3};
+    runs.add(more, 1);
+    BOOST_CHECK_EQUAL(runs.runs(), 4);
+    BOOST_CHECK(runs.runEnds().empty());
+}
+
+BOOST_AUTO_TEST_CASE(print)
+{
+    const std::vector<ya::Data> data = {1, 2, 0, 3};
+    yad::RunDetector runs(2);
+    runs.add(data.data(), data.size());
+    std::ostringstream out;
+    out << runs;
+    BOOST_CHECK_EQUAL(out.str(), "2 sorted runs");
+    runs.add(data.data(), 1);
+    out.str("");
+    out << runs;
+    BOOST_CHECK_EQUAL(out.str(), "unsorted, 3 runs");
+}
+
+BOOST_AUTO_TEST_SUITE_END() // RunDetector
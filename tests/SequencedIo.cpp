@@ -126,6 +126,25 @@ BOOST_AUTO_TEST_CASE(fill)
     BOOST_CHECK_EQUAL(buffer, data);
 }
 
+BOOST_AUTO_TEST_CASE(direct)
+{
+    const char data[] = "some text";
+    char buffer[sizeof(data)];
+    write(data);
+    yad::SequencedReader reader(path);
+    reader.setBufferSize(2);
+    BOOST_CHECK_EQUAL(reader.read(buffer, 1), 1);
+    BOOST_CHECK_EQUAL(reader.dataAvailable(), 1);
+    // buffered data is read first
+    BOOST_CHECK_EQUAL(reader.read(buffer + 1, 5), 5);
+    BOOST_CHECK_EQUAL(reader.dataAvailable(), 0);
+    // bypasses buffer
+    BOOST_CHECK_EQUAL(reader.read(buffer + 6, sizeof(data)), sizeof(data) - 6);
+    BOOST_CHECK_EQUAL(reader.dataAvailable(), 0);
+    BOOST_CHECK(reader.eof());
+    BOOST_CHECK_EQUAL(buffer, data);
+}
+
 BOOST_AUTO_TEST_SUITE_END() // Reader
 
 BOOST_AUTO_TEST_SUITE(Writer)
@@ -179,6 +198,26 @@ BOOST_AUTO_TEST_CASE(flush)
     BOOST_CHECK_EQUAL(buffer, data);
 }
 
+BOOST_AUTO_TEST_CASE(direct)
+{
+    const char data[] = "some text with size greater than buffer";
+    char buffer[sizeof(data)];
+    yad::SequencedWriter writer(path);
+    writer.setBufferSize(4);
+    writer.write(data, 2);
+    BOOST_CHECK_EQUAL(writer.spaceAvailable(), 2);
+    // buffer is not empty, data is buffered
+    writer.write(data + 2, 6);
+    BOOST_CHECK_EQUAL(writer.spaceAvailable(), 0);
+    writer.flush();
+    // bypasses buffer
+    writer.write(data + 8, sizeof(data) - 8);
+    BOOST_CHECK_EQUAL(writer.spaceAvailable(), 4);
+    writer.close();
+    read(buffer);
+    BOOST_CHECK_EQUAL(buffer, data);
+}
+
 BOOST_AUTO_TEST_SUITE_END() // Writer
 
 BOOST_AUTO_TEST_SUITE_END() // SequencedIo
@@ -0,0 +1,64 @@
+#define BOOST_TEST_MODULE coRank
+#include <boost/test/unit_test.hpp>
+
+#include "yandex/intern/detail/coRank.hpp"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace ya = yandex::intern;
+namespace yad = ya::detail;
+
+BOOST_AUTO_TEST_SUITE(coRank)
+
+BOOST_AUTO_TEST_CASE(equal)
+{
+    const std::vector<ya::Data> a = {1, 2, 2, 2}, b = {2, 2, 3};
+    const std::vector<yad::SortedRun> runs = {{a.data(), a.size()}, {b.data(), b.size()}};
+    BOOST_CHECK(yad::coRank(runs, 0) == std::vector<std::size_t>({0, 0}));
+    BOOST_CHECK(yad::coRank(runs, 1) == std::vector<std::size_t>({1, 0}));
+    // equal elements are taken from the first runs
+    BOOST_CHECK(yad::coRank(runs, 3) == std::vector<std::size_t>({3, 0}));
+    BOOST_CHECK(yad::coRank(runs, 5) == std::vector<std::size_t>({4, 1}));
+    BOOST_CHECK(yad::coRank(runs, 6) == std::vector<std::size_t>({4, 2}));
+    BOOST_CHECK(yad::coRank(runs, 7) == std::vector<std::size_t>({4, 3}));
+}
+
+BOOST_AUTO_TEST_CASE(random)
+{
+    std::mt19937 gen;
+    for (std::size_t k = 1; k <= 9; ++k)
+    {
+        std::vector<std::vector<ya::Data>> data(k);
+        std::vector<yad::SortedRun> runs;
+        std::size_t size = 0;
+        for (std::vector<ya::Data> &run: data)
+        {
+            run.resize(gen() % 100);
+            for (ya::Data &x: run)
+                x = k % 2 ? gen() % 20 : gen();
+            std::sort(run.begin(), run.end());
+            runs.push_back({run.data(), run.size()});
+            size += run.size();
+        }
+        for (std::size_t rank = 0; rank <= size; ++rank)
+        {
+            const std::vector<std::size_t> offsets = yad::coRank(runs, rank);
+            std::size_t sum = 0;
+            for (std::size_t i = 0; i < k; ++i)
+            {
+                BOOST_REQUIRE(offsets[i] <= data[i].size());
+                sum += offsets[i];
+                for (std::size_t j = 0; j < k; ++j)
+                {
+                    if (offsets[i] && offsets[j] < data[j].size())
+                        BOOST_REQUIRE(data[i][offsets[i] - 1] <= data[j][offsets[j]]);
+                }
+            }
+            BOOST_REQUIRE_EQUAL(sum, rank);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END() // coRank
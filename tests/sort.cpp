@@ -6,7 +6,9 @@
 #include "yandex/intern/generate.hpp"
 #include "yandex/intern/isSorted.hpp"
 #include "yandex/intern/detail/io.hpp"
+#include "yandex/intern/detail/RadixSorter.hpp"
 #include "yandex/intern/detail/radixSort.hpp"
+#include "yandex/intern/detail/simdSort.hpp"
 #include "yandex/intern/detail/stdSort.hpp"
 
 #include <boost/filesystem/operations.hpp>
@@ -24,6 +26,100 @@ BOOST_AUTO_TEST_CASE(sortMemory)
     ya::test::benchSort(yad::radix::sortMemory, "radix::sortMemory()");
 }
 
+BOOST_AUTO_TEST_CASE(sortMemoryDigits8)
+{
+    BOOST_REQUIRE(ya::test::testSort(yad::radix::sortMemoryDigits<8>));
+    ya::test::benchSort(yad::radix::sortMemoryDigits<8>, "radix::sortMemoryDigits<8>()");
+}
+
+BOOST_AUTO_TEST_CASE(sortMemoryDigits11)
+{
+    BOOST_REQUIRE(ya::test::testSort(yad::radix::sortMemoryDigits<11>));
+    ya::test::benchSort(yad::radix::sortMemoryDigits<11>, "radix::sortMemoryDigits<11>()");
+}
+
+BOOST_AUTO_TEST_CASE(sortMemoryDigits16)
+{
+    BOOST_REQUIRE(ya::test::testSort(yad::radix::sortMemoryDigits<16>));
+    ya::test::benchSort(yad::radix::sortMemoryDigits<16>, "radix::sortMemoryDigits<16>()");
+}
+
+BOOST_AUTO_TEST_SUITE(scatter)
+
+// 64 MiB and larger arrays do not fit into cache
+constexpr std::size_t benchSize = 64ULL * 1024 * 1024;
+
+BOOST_AUTO_TEST_CASE(direct8)
+{
+    BOOST_REQUIRE(ya::test::testSort(yad::radix::sortMemoryDigits<8, yad::radix::Scatter::direct>));
+    ya::test::benchSort(yad::radix::sortMemoryDigits<8, yad::radix::Scatter::direct>,
+                        "radix::sortMemoryDigits<8, Scatter::direct>()", benchSize);
+}
+
+BOOST_AUTO_TEST_CASE(writeCombining8)
+{
+    BOOST_REQUIRE(ya::test::testSort(yad::radix::sortMemoryDigits<8, yad::radix::Scatter::writeCombining>));
+    ya::test::benchSort(yad::radix::sortMemoryDigits<8, yad::radix::Scatter::writeCombining>,
+                        "radix::sortMemoryDigits<8, Scatter::writeCombining>()", benchSize);
+}
+
+BOOST_AUTO_TEST_CASE(direct11)
+{
+    BOOST_REQUIRE(ya::test::testSort(yad::radix::sortMemoryDigits<11, yad::radix::Scatter::direct>));
+    ya::test::benchSort(yad::radix::sortMemoryDigits<11, yad::radix::Scatter::direct>,
+                        "radix::sortMemoryDigits<11, Scatter::direct>()", benchSize);
+}
+
+BOOST_AUTO_TEST_CASE(writeCombining11)
+{
+    BOOST_REQUIRE(ya::test::testSort(yad::radix::sortMemoryDigits<11, yad::radix::Scatter::writeCombining>));
+    ya::test::benchSort(yad::radix::sortMemoryDigits<11, yad::radix::Scatter::writeCombining>,
+                        "radix::sortMemoryDigits<11, Scatter::writeCombining>()", benchSize);
+}
+
+BOOST_AUTO_TEST_CASE(bounds)
+{
+    // buckets start and end inside cache lines, some share single line
+    for (const std::size_t size: {1, 15, 17, 1000, 10001})
+    {
+        for (const ya::Data mask: {0xffffffffu, 0x0000000fu, 0x00f00f0fu})
+        {
+            BOOST_TEST_MESSAGE("size = " << size << ", mask = " << mask);
+            std::vector<ya::Data> original = ya::test::generate(size + 1);
+            for (ya::Data &x: original)
+                x &= mask;
+            // unaligned source and destination
+            std::vector<ya::Data> dst(size + 1);
+            BOOST_REQUIRE((yad::radix::sortMemoryDigits<8, yad::radix::Scatter::writeCombining>(
+                original.data() + 1, dst.data() + 1, size)));
+            BOOST_CHECK(ya::test::is_sorted(std::vector<ya::Data>(dst.begin() + 1, dst.end()),
+                                            std::vector<ya::Data>(original.begin() + 1, original.end())));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END() // scatter
+
+BOOST_AUTO_TEST_CASE(sortMemoryAdaptive)
+{
+    BOOST_REQUIRE(ya::test::testSort(yad::radix::sortMemoryAdaptive));
+    ya::test::benchSort(yad::radix::sortMemoryAdaptive, "radix::sortMemoryAdaptive()");
+    // every algorithm is chosen
+    for (const std::size_t size: {std::size_t(1), yad::radix::maxComparisonSortSize,
+                                  yad::radix::maxComparisonSortSize + 1, yad::radix::minWideDigitSize})
+    {
+        BOOST_TEST_MESSAGE("size = " << size);
+        const std::vector<ya::Data> original = ya::test::generate(size);
+        std::vector<ya::Data> dst(size);
+        BOOST_REQUIRE(yad::radix::sortMemoryAdaptive(original.data(), dst.data(), size));
+        BOOST_CHECK(std::is_sorted(dst.begin(), dst.end()));
+        std::vector<ya::Data> data = original;
+        std::vector<ya::Data> buffer(size);
+        yad::radix::sort(data, buffer);
+        BOOST_CHECK(data == dst);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(sort)
 {
     for (std::size_t i = 0; i < 1000; ++i)
@@ -36,6 +132,180 @@ BOOST_AUTO_TEST_CASE(sort)
     }
 }
 
+BOOST_AUTO_TEST_CASE(trivialBlocks)
+{
+    for (const ya::Data mask: {0x00000000u, 0x000000ffu, 0x00ff00ffu, 0xff000000u, 0x0000ffffu})
+    {
+        BOOST_TEST_MESSAGE("mask = " << mask);
+        std::vector<ya::Data> original = ya::test::generate(10000);
+        for (ya::Data &x: original)
+            x = (x & mask) | (0x12345678 & ~mask);
+        std::vector<ya::Data> data = original;
+        std::vector<ya::Data> buffer(original.size());
+        yad::radix::sort(data, buffer);
+        BOOST_CHECK(ya::test::is_sorted(data, original));
+        std::vector<ya::Data> dst(original.size());
+        BOOST_REQUIRE(yad::radix::sortMemory(original.data(), dst.data(), original.size()));
+        BOOST_CHECK(ya::test::is_sorted(dst, original));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(commonPrefix)
+{
+    std::vector<ya::Data> original = ya::test::generate(10000);
+    for (ya::Data &x: original)
+        x = 0xabc00000 | (x & 0xfffff);
+    std::vector<ya::Data> data = original;
+    BOOST_REQUIRE(yad::radix::sort(data, 0, 3));
+    BOOST_CHECK(ya::test::is_sorted(data, original));
+}
+
+BOOST_AUTO_TEST_CASE(parallelSort)
+{
+    constexpr std::size_t size = 4 * yad::radix::minParallelPartSize + 123;
+    for (const std::size_t threads: {1, 2, 3, 8})
+    {
+        for (const ya::Data mask: {0xffffffffu, 0x00ffffffu, 0xff0000ffu})
+        {
+            BOOST_TEST_MESSAGE("threads = " << threads << ", mask = " << mask);
+            std::vector<ya::Data> original = ya::test::generate(size);
+            for (ya::Data &x: original)
+                x &= mask;
+            std::vector<ya::Data> sorted = original;
+            std::sort(sorted.begin(), sorted.end());
+            std::vector<ya::Data> data = original;
+            BOOST_REQUIRE(yad::radix::parallelSort(data, 0, yad::radix::iterations, threads));
+            BOOST_CHECK(data == sorted);
+        }
+    }
+    // common prefix is not sorted
+    std::vector<ya::Data> data = ya::test::generate(size);
+    for (ya::Data &x: data)
+        x = 0xab000000 | (x & 0xffffff);
+    std::vector<ya::Data> sorted = data;
+    std::sort(sorted.begin(), sorted.end());
+    BOOST_REQUIRE(yad::radix::parallelSort(data, 0, 3, 4));
+    BOOST_CHECK(data == sorted);
+
+    for (const std::size_t threads: {std::size_t(1), yad::radix::parallelThreads()})
+    {
+        BOOST_TEST_MESSAGE("threads = " << threads);
+        ya::test::benchSort(
+            [threads](const ya::Data *const src, ya::Data *const dst, const std::size_t size)
+            {
+                std::vector<ya::Data> data(src, src + size);
+                yad::radix::parallelSort(data, 0, yad::radix::iterations, threads);
+                std::copy(data.begin(), data.end(), dst);
+            }, "radix::parallelSort()", 16 * 1024 * 1024);
+    }
+}
+
+void sortCopyInPlace(const ya::Data *const src, ya::Data *const dst, const std::size_t size)
+{
+    std::copy(src, src + size, dst);
+    yad::radix::sortInPlace(dst, size);
+}
+
+BOOST_AUTO_TEST_CASE(sortInPlace)
+{
+    BOOST_REQUIRE(ya::test::testSort(sortCopyInPlace));
+    ya::test::benchSort(sortCopyInPlace, "radix::sortInPlace()", 16 * 1024 * 1024);
+    for (const std::size_t size: {0, 1, 100, 1000, 100000, 1000000})
+    {
+        for (const ya::Data mask: {0xffffffffu, 0x0000000fu, 0xff00ff00u, 0x00ffffffu})
+        {
+            BOOST_TEST_MESSAGE("size = " << size << ", mask = " << mask);
+            std::vector<ya::Data> data = ya::test::generate(size);
+            for (ya::Data &x: data)
+                x &= mask;
+            std::vector<ya::Data> sorted = data;
+            std::sort(sorted.begin(), sorted.end());
+            std::vector<ya::Data> parallel = data;
+            yad::radix::sortInPlace(data.data(), data.size());
+            BOOST_CHECK(data == sorted);
+            yad::radix::sortInPlace(parallel.data(), parallel.size(), 0, yad::radix::iterations, 4);
+            BOOST_CHECK(parallel == sorted);
+        }
+    }
+    // common prefix is not sorted, small sizes are sorted by simdSortSmall()
+    for (const std::size_t size: {std::size_t(100), yad::radix::maxInPlaceComparisonSortSize, std::size_t(100000)})
+    {
+        BOOST_TEST_MESSAGE("size = " << size << ", common prefix");
+        std::vector<ya::Data> data = ya::test::generate(size);
+        for (ya::Data &x: data)
+            x = 0xab000000 | (x & 0xffffff);
+        std::vector<ya::Data> sorted = data;
+        std::sort(sorted.begin(), sorted.end());
+        yad::radix::sortInPlace(data.data(), data.size(), 0, 3);
+        BOOST_CHECK(data == sorted);
+    }
+    // blocks from endBlock are not common and are not ordered
+    const auto lowerBlocks = [](const ya::Data x) { return x & 0xffff; };
+    const auto byLowerBlocks = [&](const ya::Data a, const ya::Data b) { return lowerBlocks(a) < lowerBlocks(b); };
+    for (const std::size_t size: {std::size_t(100), yad::radix::maxInPlaceComparisonSortSize,
+                                  std::size_t(5000), std::size_t(100000)})
+    {
+        for (const std::size_t threads: {1, 4})
+        {
+            BOOST_TEST_MESSAGE("size = " << size << ", threads = " << threads);
+            std::vector<ya::Data> data = ya::test::generate(size);
+            std::vector<ya::Data> sorted = data;
+            yad::radix::sortInPlace(data.data(), data.size(), 0, 2, threads);
+            BOOST_CHECK(std::is_sorted(data.begin(), data.end(), byLowerBlocks));
+            std::sort(data.begin(), data.end());
+            std::sort(sorted.begin(), sorted.end());
+            BOOST_CHECK(data == sorted);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(RadixSorter)
+{
+    yad::RadixSorter sorter;
+    BOOST_CHECK_EQUAL(sorter.capacity(), 0);
+    for (const std::size_t size: {std::size_t(0), std::size_t(100), std::size_t(100000), std::size_t(1000),
+                                  std::size_t(3000000), 5 * yad::radix::minParallelPartSize})
+    {
+        for (const std::size_t threads: {1, 4})
+        {
+            BOOST_TEST_MESSAGE("size = " << size << ", threads = " << threads);
+            const std::size_t capacity = sorter.capacity();
+            std::vector<ya::Data> data = ya::test::generate(size);
+            std::vector<ya::Data> sorted = data;
+            std::sort(sorted.begin(), sorted.end());
+            BOOST_REQUIRE(sorter.sort(data, 0, yad::radix::iterations, threads));
+            BOOST_CHECK(data == sorted);
+            // scratch only grows
+            BOOST_CHECK_GE(sorter.capacity(), capacity);
+        }
+    }
+    // common prefix is not sorted
+    std::vector<ya::Data> data = ya::test::generate(100000);
+    for (ya::Data &x: data)
+        x = 0xab000000 | (x & 0xffffff);
+    std::vector<ya::Data> sorted = data;
+    std::sort(sorted.begin(), sorted.end());
+    BOOST_REQUIRE(sorter.sort(data, 0, 3));
+    BOOST_CHECK(data == sorted);
+    sorter.release();
+    BOOST_CHECK_EQUAL(sorter.capacity(), 0);
+
+    ya::test::benchSort(
+        [](const ya::Data *const src, ya::Data *const dst, const std::size_t size)
+        {
+            std::vector<ya::Data> data(src, src + size);
+            yad::radix::sort(data);
+            std::copy(data.begin(), data.end(), dst);
+        }, "radix::sort()", 16 * 1024 * 1024);
+    ya::test::benchSort(
+        [&sorter](const ya::Data *const src, ya::Data *const dst, const std::size_t size)
+        {
+            std::vector<ya::Data> data(src, src + size);
+            sorter.sort(data);
+            std::copy(data.begin(), data.end(), dst);
+        }, "RadixSorter::sort()", 16 * 1024 * 1024);
+}
+
 struct sortFileFixture
 {
     sortFileFixture():
@@ -80,12 +350,72 @@ BOOST_FIXTURE_TEST_CASE(sortFile, sortFileFixture)
     }
 }
 
+BOOST_FIXTURE_TEST_CASE(sortFileInPlace, sortFileFixture)
+{
+    generate();
+    const std::vector<ya::Data> original = yad::io::readFromFile(src);
+    yad::radix::sortFileInPlace(src, dst);
+    BOOST_CHECK(ya::isSorted(dst));
+    BOOST_CHECK(ya::test::is_sorted(yad::io::readFromFile(dst), original));
+    yad::radix::sortFileInPlace(src, src);
+    BOOST_CHECK(ya::isSorted(src));
+    BOOST_CHECK(ya::test::is_sorted(yad::io::readFromFile(src), original));
+}
+
+BOOST_FIXTURE_TEST_CASE(sortFilePresorted, sortFileFixture)
+{
+    generate();
+    std::vector<ya::Data> sorted = yad::io::readFromFile(src);
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<ya::Data> reversed(sorted.rbegin(), sorted.rend());
+    // two runs
+    std::vector<ya::Data> runs = yad::io::readFromFile(src);
+    const std::size_t middle = runs.size() / 3;
+    std::sort(runs.begin(), runs.begin() + middle);
+    std::sort(runs.begin() + middle, runs.end());
+    for (const std::vector<ya::Data> *const data: {&sorted, &reversed, &runs})
+    {
+        yad::io::writeToFile(src, *data);
+        const yad::RunDetector detected = yad::radix::sortFile(src, dst);
+        BOOST_CHECK_EQUAL(detected.runs() == 1, data == &sorted);
+        BOOST_CHECK_EQUAL(detected.isReversed(), data == &reversed);
+        BOOST_CHECK(yad::io::readFromFile(dst) == sorted);
+        yad::radix::sortFileInPlace(src, dst);
+        BOOST_CHECK(yad::io::readFromFile(dst) == sorted);
+        yad::radix::sortFile(src, src);
+        BOOST_CHECK(yad::io::readFromFile(src) == sorted);
+    }
+    boost::filesystem::remove(dst);
+}
+
 BOOST_AUTO_TEST_SUITE_END() // radix
 
 BOOST_AUTO_TEST_CASE(stdSort)
 {
     BOOST_REQUIRE(ya::test::testSort(yad::stdSort));
-    ya::test::benchSort(yad::stdSort, "stdSort()");
+    ya::test::benchSort(yad::stdSort, "stdSort()", 64 * 1024, 16);
+}
+
+BOOST_AUTO_TEST_CASE(simdSort)
+{
+    BOOST_REQUIRE(ya::test::testSort(yad::simdSort));
+    ya::test::benchSort(yad::simdSort, "simdSort()", 64 * 1024, 16);
+    for (std::size_t size = 0; size <= 300; ++size)
+    {
+        for (const ya::Data mask: {0xffffffffu, 0x3u, 0x80000001u})
+        {
+            std::vector<ya::Data> data = ya::test::generate(size);
+            for (ya::Data &x: data)
+                x = (x & mask) | (x & 0x10000 ? 0 : 0xffffffff & mask);
+            std::vector<ya::Data> sorted = data;
+            std::sort(sorted.begin(), sorted.end());
+            std::vector<ya::Data> dst(size);
+            BOOST_REQUIRE(yad::simdSort(data.data(), dst.data(), size));
+            BOOST_CHECK(dst == sorted);
+            yad::simdSortSmall(data.data(), size);
+            BOOST_CHECK(data == sorted);
+        }
+    }
 }
 
 BOOST_AUTO_TEST_SUITE_END() // sort
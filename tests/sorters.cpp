@@ -0,0 +1,205 @@
+#define BOOST_TEST_MODULE sorters
+#include <boost/test/unit_test.hpp>
+
+#include "yandex/intern/generate.hpp"
+#include "yandex/intern/isSorted.hpp"
+#include "yandex/intern/sorters/BalancedSplitSorter.hpp"
+#include "yandex/intern/sorters/InMemorySorter.hpp"
+#include "yandex/intern/sorters/MappedRadixSorter.hpp"
+#include "yandex/intern/sorters/SplitMergeSorter.hpp"
+#include "yandex/intern/detail/io.hpp"
+
+#include <boost/filesystem/operations.hpp>
+
+#include <algorithm>
+
+namespace ya = yandex::intern;
+namespace yad = ya::detail;
+namespace yas = ya::sorters;
+
+struct SorterFixture
+{
+    SorterFixture():
+        src(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()),
+        dst(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path())
+    {
+    }
+
+    ~SorterFixture()
+    {
+        boost::filesystem::remove(src);
+        boost::filesystem::remove(dst);
+    }
+
+    void generate(const std::size_t size, const bool biased)
+    {
+        if (biased)
+            ya::generate_biased(src, size);
+        else
+            ya::generate_unbiased(src, size);
+        sorted = yad::io::readFromFile(src);
+        std::sort(sorted.begin(), sorted.end());
+    }
+
+    void check()
+    {
+        BOOST_CHECK(ya::isSorted(dst));
+        BOOST_CHECK(yad::io::readFromFile(dst) == sorted);
+    }
+
+    template <typename Sort>
+    void test(const std::size_t size, const Sort &sort)
+    {
+        for (const bool biased: {false, true})
+        {
+            BOOST_TEST_MESSAGE("size = " << size << ", biased = " << biased);
+            generate(size, biased);
+            sort();
+            check();
+        }
+    }
+
+    const boost::filesystem::path src;
+    const boost::filesystem::path dst;
+    std::vector<ya::Data> sorted;
+};
+
+constexpr std::size_t memoryLimitBytes = 8 * 1024 * 1024;
+constexpr std::size_t size = 32 * 1024 * 1024;
+
+BOOST_FIXTURE_TEST_SUITE(sorters, SorterFixture)
+
+BOOST_AUTO_TEST_CASE(InMemorySorter)
+{
+    test(size, [this]() { ya::sort<yas::InMemorySorter>(src, dst, 2 * size); });
+}
+
+BOOST_AUTO_TEST_CASE(InMemorySorterInPlace)
+{
+    // no memory for radix buffer
+    test(size, [this]() { ya::sort<yas::InMemorySorter>(src, dst, size); });
+}
+
+BOOST_AUTO_TEST_CASE(SplitMergeSorter)
+{
+    test(size, [this]() { ya::sort<yas::SplitMergeSorter>(src, dst, memoryLimitBytes); });
+}
+
+BOOST_AUTO_TEST_CASE(SplitMergeSorterReplacementSelection)
+{
+    test(size,
+        [this]()
+        {
+            yas::SplitMergeSorter sorter(src, dst, memoryLimitBytes,
+                                         yas::SplitMergeSorter::RunGeneration::replacementSelection);
+            static_cast<ya::Sorter &>(sorter).sort();
+        });
+}
+
+BOOST_AUTO_TEST_CASE(SplitMergeSorterNearlySorted)
+{
+    // replacement selection is chosen automatically
+    generate(size, false);
+    std::vector<ya::Data> data = sorted;
+    for (std::size_t i = 0; i + 100 < data.size(); i += 1000)
+        std::swap(data[i], data[i + 100]);
+    yad::io::writeToFile(src, data);
+    ya::sort<yas::SplitMergeSorter>(src, dst, memoryLimitBytes);
+    check();
+}
+
+BOOST_AUTO_TEST_CASE(MappedRadixSorter)
+{
+    test(size, [this]() { ya::sort<yas::MappedRadixSorter>(src, dst, memoryLimitBytes); });
+}
+
+BOOST_AUTO_TEST_CASE(MappedRadixSorterInPlace)
+{
+    generate(size, false);
+    ya::sort<yas::MappedRadixSorter>(src, src, memoryLimitBytes);
+    BOOST_CHECK(yad::io::readFromFile(src) == sorted);
+}
+
+BOOST_AUTO_TEST_SUITE(BalancedSplitSorter)
+
+typedef yas::BalancedSplitSorter::PrefixSplitMode PrefixSplitMode;
+
+void sort(const boost::filesystem::path &src, const boost::filesystem::path &dst,
+          const PrefixSplitMode prefixSplitMode)
+{
+    yas::BalancedSplitSorter sorter(src, dst, memoryLimitBytes, prefixSplitMode);
+    static_cast<ya::Sorter &>(sorter).sort();
+}
+
+BOOST_AUTO_TEST_CASE(histogram)
+{
+    test(size, [this]() { sort(src, dst, PrefixSplitMode::histogram); });
+}
+
+BOOST_AUTO_TEST_CASE(sampling)
+{
+    test(size, [this]() { sort(src, dst, PrefixSplitMode::sampling); });
+}
+
+BOOST_AUTO_TEST_CASE(bytesRead)
+{
+    // sampling saves the first pass over input
+    const std::size_t inputSize = 4 * size;
+    generate(inputSize, false);
+    std::size_t bytesRead[2];
+    for (const PrefixSplitMode prefixSplitMode: {PrefixSplitMode::histogram, PrefixSplitMode::sampling})
+    {
+        yas::BalancedSplitSorter sorter(src, dst, memoryLimitBytes, prefixSplitMode);
+        static_cast<ya::Sorter &>(sorter).sort();
+        check();
+        bytesRead[prefixSplitMode == PrefixSplitMode::sampling] = sorter.bytesRead();
+    }
+    BOOST_TEST_MESSAGE("histogram: " << bytesRead[0] << ", sampling: " << bytesRead[1] <<
+                       " bytes read of " << inputSize);
+    BOOST_CHECK_EQUAL(bytesRead[0], 3 * inputSize);
+    BOOST_CHECK_LT(bytesRead[1], 2 * inputSize + inputSize / 4);
+}
+
+BOOST_AUTO_TEST_CASE(oversized)
+{
+    // not sampled blocks of sorted input are underestimated
+    generate(size, false);
+    yad::io::writeToFile(src, sorted);
+    sort(src, dst, PrefixSplitMode::sampling);
+    check();
+}
+
+BOOST_AUTO_TEST_CASE(narrow)
+{
+    // parts have at most 16 free bits and are stored as suffixes
+    generate(size, false);
+    std::vector<ya::Data> data = yad::io::readFromFile(src);
+    for (ya::Data &x: data)
+        x = 0x12300000 | (x & 0xfffff);
+    yad::io::writeToFile(src, data);
+    sorted = data;
+    std::sort(sorted.begin(), sorted.end());
+    sort(src, dst, PrefixSplitMode::histogram);
+    check();
+}
+
+BOOST_AUTO_TEST_CASE(presorted)
+{
+    // sorted and reverse sorted inputs are copied
+    generate(size, false);
+    for (const bool reverse: {false, true})
+    {
+        if (reverse)
+            yad::io::writeToFile(src, std::vector<ya::Data>(sorted.rbegin(), sorted.rend()));
+        else
+            yad::io::writeToFile(src, sorted);
+        sort(src, dst, PrefixSplitMode::histogram);
+        check();
+        sort(src, src, PrefixSplitMode::histogram);
+        BOOST_CHECK(yad::io::readFromFile(src) == sorted);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END() // BalancedSplitSorter
+
+BOOST_AUTO_TEST_SUITE_END() // sorters
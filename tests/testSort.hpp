@@ -55,11 +55,13 @@ namespace yandex{namespace intern{namespace test
     }
 
     template <typename Sort>
-    void benchSort(const Sort &sort, const char *const name)
+    void benchSort(const Sort &sort, const char *const name,
+                   const std::size_t maxSize=1ULL * 1024 * 1024,
+                   const std::size_t minSize=1024)
     {
-        for (std::size_t size = 1024; size <= 1ULL * 1024 * 1024; size *= 4)
+        for (std::size_t size = minSize; size <= maxSize; size *= 4)
         {
-            const std::size_t iterations = 16ULL * 1024 * 1024 / size;
+            const std::size_t iterations = std::max(16ULL * 1024 * 1024 / size, 1ULL);
             std::vector<Data> original(size);
             std::vector<Data> sorted(size);
             std::generate(original.begin(), original.end(), [&](){return rnd(rng);});